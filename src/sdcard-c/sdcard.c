@@ -51,6 +51,28 @@ void setup_timer() {
     TR0 = 1;
 }
 
+#ifdef SIM
+
+// ucsim has no duart, print on the on-chip serial port at 9600 baud from
+// timer 1 instead
+void setup_uart() {
+    SCON = 0x50;
+    TMOD = (TMOD & 0x0F) | 0x20;
+    TH1 = 0xFD;
+    TL1 = 0xFD;
+    TR1 = 1;
+    TI = 1;
+}
+
+int putchar(int c) {
+    while (!TI);
+    TI = 0;
+    SBUF = c;
+    return 0;
+}
+
+#else
+
 // setup the uart for 230400 8N1 (11.0592 MHz PCLK on DUART)
 void setup_uart() {
     __code const uint8_t init_data[] = {
@@ -95,6 +117,85 @@ int putchar(int c) {
     return 0;
 }
 
+#endif
+
+#ifdef SIM
+
+// nothing is behind the spi port in ucsim either, so the sim build answers
+// the commands used here like an sdhc card would. every response starts
+// with one 0xFF before R1. data bytes of a block are (offset ^ block), so
+// reads can be checked. making them up costs less than clocking them off
+// the card, so only compare the numbers between builds.
+static uint8_t sim_cmd[6];
+static uint8_t sim_in = 0;
+static uint16_t sim_pos = 0;
+static uint16_t sim_len = 0;
+
+static __code const uint8_t sim_r7[] = { 0x01, 0x00, 0x00, 0x01, 0xAA };
+static __code const uint8_t sim_ocr[] = { 0x00, 0xC0, 0xFF, 0x80, 0x00 };
+
+static uint16_t sim_length(void) {
+    switch (sim_cmd[0] & 0x3F) {
+    case 8:
+    case 58:
+        return 6;
+    case 17:
+        return 4 + 512 + 2;
+    default:
+        return 2;
+    }
+}
+
+static uint8_t sim_response(uint16_t pos) {
+    if (pos == 0) {
+        return 0xFF;
+    }
+    switch (sim_cmd[0] & 0x3F) {
+    case 0:
+    case 55:
+        return 0x01;
+    case 8:
+        return sim_r7[pos - 1];
+    case 41:
+        return 0x00;
+    case 58:
+        return sim_ocr[pos - 1];
+    case 17:
+        // r1, a gap, the block start token, the block and its crc
+        if (pos == 1) {
+            return 0x00;
+        }
+        if (pos == 3) {
+            return 0xFE;
+        }
+        if (pos >= 4 && pos < 4 + 512) {
+            return (uint8_t) (pos - 4) ^ sim_cmd[4];
+        }
+        return 0xFF;
+    default:
+        return 0x04;
+    }
+}
+
+uint8_t spi_transfer(uint8_t b) {
+    if (sim_pos != sim_len) {
+        return sim_response(sim_pos++);
+    }
+    if (sim_in || (b & 0xC0) == 0x40) {
+        sim_cmd[sim_in++] = b;
+        if (sim_in == sizeof sim_cmd) {
+            sim_in = 0;
+            sim_pos = 0;
+            sim_len = sim_length();
+        }
+    }
+    return 0xFF;
+}
+
+#define spi_transfer_fast spi_transfer
+
+#else
+
 uint8_t spi_transfer(uint8_t b) {
     spi.data = b;
     return spi.data;
@@ -105,6 +206,8 @@ inline uint8_t spi_transfer_fast(uint8_t b) {
     return spi.data;
 }
 
+#endif
+
 
 #define SD_CARD_SELECT 3
 
@@ -371,6 +474,85 @@ void copy_pdata(uint8_t __pdata* a, uint8_t __pdata* b, uint8_t size) {
     } while (size--);
 }
 
+#ifdef SIM
+
+// machine cycles since setup_timer(), from the centisecond count and the
+// live timer 0 count. the interrupt reloads TH0 only, so this is close
+// enough for a benchmark.
+static uint32_t sim_cycles(void) {
+    uint32_t ticks;
+    uint8_t high, low;
+
+    ET0 = 0;
+    do {
+        high = TH0;
+        low = TL0;
+    } while (high != TH0);
+    ticks = centiseconds;
+    ET0 = 1;
+    return ticks * 9216 + ((((uint16_t) high << 8) | low) - 0xDC00);
+}
+
+// "<phase> <count>" line for tools/build-matrix.py, printf_tiny can't do 32 bits
+static void print_phase(const __code char* phase, uint32_t n) {
+    __xdata static char digits[11];
+    uint8_t i = sizeof digits - 1;
+
+    digits[i] = 0;
+    do {
+        digits[--i] = '0' + (uint8_t) (n % 10);
+        n /= 10;
+    } while (n);
+    printf_tiny("%s ", phase);
+    while (digits[i]) {
+        putchar(digits[i++]);
+    }
+    printf_tiny("\r\n");
+}
+
+// the benchmark below in cycles, against the simulated card, ending with
+// "done" for tools/ucsim.py
+void main(void) {
+    __xdata static uint8_t buffer[512];
+    uint32_t start, block;
+    uint16_t errors = 0;
+    uint16_t i;
+
+    // setup_timer() sets all of TMOD, so it goes before the serial port
+    setup_timer();
+    setup_uart();
+    EA = 1;
+
+    start = sim_cycles();
+    if (sd_init() || !sd_hc) {
+        printf_tiny("failed to init sd card\r\n");
+        goto end;
+    }
+    print_phase("init", sim_cycles() - start);
+
+    // 64 KiB in single block reads
+    start = sim_cycles();
+    for (block = 0; block != 128; block++) {
+        if (sd_read(block, buffer)) {
+            errors++;
+            break;
+        }
+    }
+    print_phase("read-512", sim_cycles() - start);
+    for (i = 0; i != sizeof buffer; i++) {
+        if (buffer[i] != ((uint8_t) i ^ 127)) {
+            errors++;
+        }
+    }
+    print_phase("errors", errors);
+
+end:
+    printf_tiny("done\r\n");
+    while (1);
+}
+
+#else
+
 void main(void) {
     setup_uart();
     setup_timer();
@@ -428,3 +610,5 @@ void main(void) {
     // spin forever
     while (1);
 }
+
+#endif
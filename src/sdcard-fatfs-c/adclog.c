@@ -0,0 +1,213 @@
+#include <8051.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "diskio.h"
+#include "pff.h"
+#include "timebase.h"
+#include "timer.h"
+#include "uart.h"
+
+// P80C550 on-chip adc. writing ADCON with ADCS set starts a conversion of
+// the channel in AADR2..0, ADCI is set when the result is in ADAT and is
+// cleared by the next write to ADCON.
+__sfr __at(0xC5) ADCON;
+__sfr __at(0xC6) ADAT;
+
+#define ADCON_ADCI 0x10
+#define ADCON_ADCS 0x08
+#define ADCON_AADR 0x07
+
+// channels to sample, bit n selects channel n. override from the Makefile.
+#ifndef ADCLOG_CHANNELS
+#define ADCLOG_CHANNELS 0x0F
+#endif
+
+// sectors per ping-pong buffer
+#ifndef ADCLOG_BUF_SECTORS
+#define ADCLOG_BUF_SECTORS 2
+#endif
+
+#define ADCLOG_BUF_SIZE (ADCLOG_BUF_SECTORS * 512)
+
+// capture file, preallocated on first use and overwritten by every run
+#define ADCLOG_PATH "ADC.BIN"
+#define ADCLOG_SIZE 0x400000
+
+// length of each run of the rate sweep
+#define ADCLOG_TICKS 300
+
+// timer 1 runs in 8 bit auto reload mode, counting machine cycles. each
+// overflow stores the last conversion and starts the next one, so the
+// aggregate sample rate is 921600 / period. the sweep steps down through
+// these periods until samples are lost.
+static __code const uint16_t periods[] = {256, 192, 128, 96, 80, 64, 56, 48, 40, 32};
+
+// sampling state, all in internal ram so the isr stays short
+static __xdata uint8_t adc_buf[2][ADCLOG_BUF_SIZE];
+static __xdata uint8_t* __data adc_ptr;
+static __data uint16_t adc_left;
+static __data uint8_t adc_active;
+static volatile __data uint8_t adc_full;    // bit n set when buffer n waits for the card
+static __data uint8_t adc_seq[8];
+static __data uint8_t adc_nseq;
+static __data uint8_t adc_idx;
+
+// loss counters
+static volatile __data uint16_t adc_dropped;   // buffers overwritten before the card took them
+static volatile __data uint16_t adc_overruns;  // ticks that found the conversion unfinished
+
+// sdcc requires interrupt handlers to be declared in the file containing main()
+void adc_isr(void) __interrupt(TF1_VECTOR);
+
+void adc_isr(void) __interrupt(TF1_VECTOR) {
+    if (!(ADCON & ADCON_ADCI)) {
+        adc_overruns++;
+        return;
+    }
+    *(adc_ptr++) = ADAT;
+
+    // next channel
+    if (++adc_idx == adc_nseq) {
+        adc_idx = 0;
+    }
+    ADCON = adc_seq[adc_idx] | ADCON_ADCS;
+
+    // buffer full, swap if the card has taken the other one, otherwise start
+    // this one over and count the loss
+    if (!--adc_left) {
+        adc_left = ADCLOG_BUF_SIZE;
+        if (adc_full & (2 >> adc_active)) {
+            adc_dropped++;
+        } else {
+            adc_full |= 1 << adc_active;
+            adc_active ^= 1;
+        }
+        adc_ptr = adc_buf[adc_active];
+    }
+}
+
+void adc_start(uint8_t period) {
+    uint8_t i;
+
+    adc_nseq = 0;
+    for (i = 0; i != 8; i++) {
+        if (ADCLOG_CHANNELS & (1 << i)) {
+            adc_seq[adc_nseq++] = i;
+        }
+    }
+    adc_idx = 0;
+    adc_active = 0;
+    adc_full = 0;
+    adc_ptr = adc_buf[0];
+    adc_left = ADCLOG_BUF_SIZE;
+    adc_dropped = 0;
+    adc_overruns = 0;
+
+    // first conversion, then timer 1 in mode 2
+    ADCON = adc_seq[0] | ADCON_ADCS;
+    TMOD = (TMOD & 0x0F) | 0x20;
+    TH1 = period;
+    TL1 = period;
+    ET1 = 1;
+    TR1 = 1;
+}
+
+void adc_stop(void) {
+    TR1 = 0;
+    ET1 = 0;
+    TF1 = 0;
+}
+
+// sample at one rate for a few seconds, streaming full buffers to the card
+// in one multiple block write. returns the number of sectors written, or 0
+// on a disk error.
+uint32_t adc_run(DWORD sect, DWORD count, uint8_t period) {
+    uint32_t start, written = 0;
+    uint8_t next = 0, i;
+    __xdata uint8_t* p;
+
+    if (disk_write_start(sect, (UINT) (count > 0xFFFF ? 0xFFFF : count))) {
+        return 0;
+    }
+    adc_start(period);
+    start = timebase_ticks();
+    while (timebase_ticks() - start < ADCLOG_TICKS && written + ADCLOG_BUF_SECTORS <= count) {
+        if (!(adc_full & (1 << next))) {
+            continue;
+        }
+        p = adc_buf[next];
+        for (i = 0; i != ADCLOG_BUF_SECTORS; i++) {
+            // a card that stays busy ends the run, a rejected block has
+            // ended the transfer already
+            timer_arm(TIMER_SD_BUSY, SD_WRITE_TIMEOUT);
+            while (disk_busy()) {
+                if (timer_expired(TIMER_SD_BUSY)) {
+                    adc_stop();
+                    disk_write_stop();
+                    return 0;
+                }
+            }
+            if (disk_write_block(p)) {
+                adc_stop();
+                return 0;
+            }
+            p += 512;
+        }
+        written += ADCLOG_BUF_SECTORS;
+
+        // hand the buffer back to the isr
+        ET1 = 0;
+        adc_full &= ~(1 << next);
+        ET1 = 1;
+        next ^= 1;
+    }
+    adc_stop();
+    if (disk_write_stop()) {
+        return 0;
+    }
+    return written;
+}
+
+void main(void) {
+    __xdata static FATFS fs;
+    __xdata static FIL f;
+    __xdata static DWORD sect, count;
+    uint32_t written, best = 0;
+    uint16_t period;
+    uint8_t i;
+
+    uart_setup();
+    timebase_setup();
+    EA = 1;
+
+    if (pf_mount(&fs) != FR_OK) {
+        printf_tiny("failed to mount sd card\r\n");
+        goto end;
+    }
+    if (pf_fopen(&f, ADCLOG_PATH) != FR_OK
+            || (f.fsize < ADCLOG_SIZE && pf_fexpand(&f, ADCLOG_SIZE) != FR_OK)
+            || pf_fextent(&f, &sect, &count) != FR_OK) {
+        printf_tiny("failed to prepare " ADCLOG_PATH ", it must exist and be contiguous\r\n");
+        goto end;
+    }
+
+    // step the rate up until the card can't keep up
+    for (i = 0; i != sizeof periods / sizeof periods[0]; i++) {
+        period = periods[i];
+        written = adc_run(sect, count, (uint8_t) (256 - period));
+        print_count("sample rate, all channels (Hz): ", 921600 / period);
+        print_count("sectors written: ", written);
+        printf_tiny("dropped buffers: %u\r\noverruns: %u\r\n", adc_dropped, adc_overruns);
+        if (!written || adc_dropped || adc_overruns) {
+            break;
+        }
+        best = 921600 / period;
+    }
+    print_count("highest sustained sample rate (Hz): ", best);
+
+end:
+    uart_flush();
+    while (1);
+}
@@ -0,0 +1,171 @@
+/*-----------------------------------------------------------------------*/
+/* Set associative sector cache for Petit FatFs                          */
+/*-----------------------------------------------------------------------*/
+
+#include "cache.h"
+
+#include "xmem.h"
+
+#define CACHE_EMPTY 0xFF
+
+#if (CACHE_SETS & (CACHE_SETS - 1)) || CACHE_WAYS > 16
+#error CACHE_SETS must be a power of two and CACHE_WAYS at most 16
+#endif
+
+struct cache_line {
+    DWORD sector;
+    BYTE kind;      // CACHE_DATA/FAT/DIR, or CACHE_EMPTY
+    BYTE age;       // 0 is the most recently used way of the set
+};
+
+static __xdata struct cache_line cache_lines[CACHE_SETS][CACHE_WAYS];
+static __xdata BYTE cache_data[CACHE_SETS][CACHE_WAYS][512];
+
+__xdata struct cache_stats cache_stats;
+
+// make a way the most recently used of its set. ages stay a permutation of
+// 0..CACHE_WAYS-1, so the oldest way is always the one with the largest age.
+static void cache_touch(__xdata struct cache_line* set, BYTE way) {
+    BYTE age = set[way].age;
+    BYTE i;
+
+    for (i = 0; i != CACHE_WAYS; i++) {
+        if (set[i].age < age) {
+            set[i].age++;
+        }
+    }
+    set[way].age = 0;
+}
+
+// way to replace for a sector of this kind, or CACHE_WAYS if there's none
+static BYTE cache_victim(__xdata struct cache_line* set, BYTE kind) {
+    BYTE i, way = CACHE_WAYS, age = 0;
+
+    for (i = 0; i != CACHE_WAYS; i++) {
+        if (set[i].kind == CACHE_EMPTY) {
+            return i;
+        }
+        // only fat and directory reads may push out pinned lines
+        if (kind == CACHE_DATA && (CACHE_PIN & (1 << set[i].kind))) {
+            continue;
+        }
+        if (way == CACHE_WAYS || set[i].age > age) {
+            way = i;
+            age = set[i].age;
+        }
+    }
+    return way;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Reset Cache                                                           */
+/*-----------------------------------------------------------------------*/
+
+void cache_reset (void) PF_REENTRANT
+{
+    BYTE s, w;
+
+    for (s = 0; s != CACHE_SETS; s++) {
+        for (w = 0; w != CACHE_WAYS; w++) {
+            cache_lines[s][w].kind = CACHE_EMPTY;
+            cache_lines[s][w].age = w;
+        }
+    }
+    cache_stats.hits = 0;
+    cache_stats.misses = 0;
+    cache_stats.evictions = 0;
+    cache_stats.bypasses = 0;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Partial Sector through the Cache                                 */
+/*-----------------------------------------------------------------------*/
+
+DRESULT cache_readp (
+	__xdata BYTE* buff,		/* Pointer to the destination object (NULL:Forward to the sink) */
+	DWORD sector,	/* Sector number (LBA) */
+	UINT offset,	/* Offset in the sector */
+	UINT count,		/* Byte count */
+	BYTE kind		/* CACHE_DATA, CACHE_FAT or CACHE_DIR */
+) PF_REENTRANT
+{
+    __xdata struct cache_line* set;
+    __xdata BYTE* line;
+    BYTE way;
+
+    // sanity check
+    if (count + offset > 512) {
+        return RES_PARERR;
+    }
+
+    // forwarded reads go to the sink as they come off the card
+    if (!buff) {
+        cache_stats.bypasses++;
+        return disk_readp(buff, sector, offset, count);
+    }
+
+    set = cache_lines[(BYTE) sector & (CACHE_SETS - 1)];
+    for (way = 0; way != CACHE_WAYS; way++) {
+        if (set[way].kind != CACHE_EMPTY && set[way].sector == sector) {
+            break;
+        }
+    }
+
+    if (way != CACHE_WAYS) {
+        cache_stats.hits++;
+    } else {
+        // a whole data sector is read straight into the caller's buffer,
+        // going through a line would cost a second 512 byte copy
+        if (kind == CACHE_DATA && count == 512) {
+            cache_stats.bypasses++;
+            return disk_readp(buff, sector, 0, 512);
+        }
+        way = cache_victim(set, kind);
+        if (way == CACHE_WAYS) {
+            cache_stats.bypasses++;
+            return disk_readp(buff, sector, offset, count);
+        }
+        cache_stats.misses++;
+        if (set[way].kind != CACHE_EMPTY) {
+            cache_stats.evictions++;
+        }
+        set[way].kind = CACHE_EMPTY;
+        if (disk_readp(cache_data[(BYTE) sector & (CACHE_SETS - 1)][way], sector, 0, 512)) {
+            return RES_ERROR;
+        }
+        set[way].sector = sector;
+    }
+    // a sector read as fat or directory keeps that kind, so it stays pinned
+    if (kind != CACHE_DATA || set[way].kind == CACHE_EMPTY) {
+        set[way].kind = kind;
+    }
+    cache_touch(set, way);
+
+    line = cache_data[(BYTE) sector & (CACHE_SETS - 1)][way] + offset;
+    xmem_copy(buff, line, count);
+    return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Invalidate a Sector                                                   */
+/*-----------------------------------------------------------------------*/
+
+void cache_invalidate (
+	DWORD sector	/* Sector number (LBA) that is being written */
+) PF_REENTRANT
+{
+    __xdata struct cache_line* set = cache_lines[(BYTE) sector & (CACHE_SETS - 1)];
+    BYTE way;
+
+    for (way = 0; way != CACHE_WAYS; way++) {
+        if (set[way].kind != CACHE_EMPTY && set[way].sector == sector) {
+            set[way].kind = CACHE_EMPTY;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+/*-----------------------------------------------------------------------
+/  Sector cache between Petit FatFs and the disk I/O module
+/-----------------------------------------------------------------------*/
+/* Off by default (PF_USE_CACHE in pffconf.h). Without it, FAT entries and
+/  directory entries are read with partial sector reads that diskio.c cuts
+/  short with CMD12 (disk_early_stop), which is the default path. With it,
+/  FAT, directory and partial data reads load whole sectors into lines, so
+/  early stop only applies to reads that go past the cache. Whole data
+/  sectors that miss are always read past it. */
+
+#ifndef _CACHE_DEFINED
+#define _CACHE_DEFINED
+
+#include "diskio.h"
+
+
+/* Geometry, override from the Makefile to trade XRAM for fewer card
+/  reads. Each line is one 512 byte sector, CACHE_SETS must be a power of
+/  two. The default is 4 sets of 2 ways, 4 KiB of XRAM. */
+#ifndef CACHE_SETS
+#define CACHE_SETS		4
+#endif
+#ifndef CACHE_WAYS
+#define CACHE_WAYS		2
+#endif
+
+/* Kind of sector being read */
+#define CACHE_DATA		0
+#define CACHE_FAT		1
+#define CACHE_DIR		2
+
+/* Kinds that are pinned. A data sector never evicts a pinned line, it is
+/  read past the cache instead when its set holds nothing else. */
+#define CACHE_PIN_FAT	(1 << CACHE_FAT)
+#define CACHE_PIN_DIR	(1 << CACHE_DIR)
+#ifndef CACHE_PIN
+#define CACHE_PIN		(CACHE_PIN_FAT | CACHE_PIN_DIR)
+#endif
+
+
+/* Counters for benchmarks, cleared by cache_reset() */
+struct cache_stats {
+	DWORD hits;			/* Reads served from a line */
+	DWORD misses;		/* Reads that loaded a line from the card */
+	DWORD evictions;	/* Valid lines replaced by a miss */
+	DWORD bypasses;		/* Reads sent straight to the card, whole data sectors among them */
+};
+
+extern __xdata struct cache_stats cache_stats;
+
+
+/*---------------------------------------*/
+/* Prototypes for cache functions        */
+
+void cache_reset (void) PF_REENTRANT;
+DRESULT cache_readp (__xdata BYTE* buff, DWORD sector, UINT offset, UINT count, BYTE kind) PF_REENTRANT;
+void cache_invalidate (DWORD sector) PF_REENTRANT;
+
+#endif	/* _CACHE_DEFINED */
@@ -0,0 +1,241 @@
+#include "datalog.h"
+
+#include "diskio.h"
+#include "timer.h"
+#include "xmem.h"
+
+static __xdata uint8_t datalog_buf[2][DATALOG_BUF_SIZE];
+
+static __xdata struct {
+    FIL file;
+    uint32_t header;        // first of the two header sectors
+    uint32_t data;          // first record data sector, after the headers
+    uint32_t sectors;       // record data sectors available
+    uint32_t start;         // log offset of the filling buffer, sector aligned
+    uint16_t fill;          // bytes in the filling buffer
+    uint8_t active;         // filling buffer
+    uint8_t open;
+    uint8_t error;
+
+    // buffer handed to the writer
+    uint8_t pending;
+    uint8_t pend_buf;
+    uint32_t pend_start;
+    uint16_t pend_bytes;
+
+    struct pt pt;
+    struct datalog_header hdr;
+} dl;
+
+__xdata uint32_t datalog_records;
+__xdata uint32_t datalog_dropped;
+__xdata uint32_t datalog_buffers;
+
+// write the header sector not holding the last commit, the rest of it is
+// padded with zeros
+static uint8_t datalog_commit(uint32_t committed) {
+    dl.hdr.committed = committed;
+    dl.hdr.sequence++;
+    pf_invalidate(dl.header + (dl.hdr.sequence & 1), 1);
+    return disk_writep(0, dl.header + (dl.hdr.sequence & 1))
+        || disk_writep((const __xdata uint8_t*) &dl.hdr, sizeof dl.hdr)
+        || disk_writep(0, 0);
+}
+
+// nonzero if a header sector read back is one of this log's
+static uint8_t datalog_valid(const __xdata struct datalog_header* hdr) {
+    return hdr->magic[0] == 'D' && hdr->magic[1] == 'L' && hdr->magic[2] == 'O'
+        && hdr->magic[3] == 'G' && hdr->committed <= dl.sectors * 512;
+}
+
+// give the filling buffer to the writer and start on the other one
+static void datalog_hand_over(void) {
+    // zero the unused end of the last sector
+    if (dl.fill & 511) {
+        xmem_fill(&datalog_buf[dl.active][dl.fill], 0, 512 - (dl.fill & 511));
+    }
+    dl.pend_buf = dl.active;
+    dl.pend_start = dl.start;
+    dl.pend_bytes = dl.fill;
+    dl.pending = 1;
+    dl.active ^= 1;
+    dl.start += dl.fill;
+    dl.fill = 0;
+}
+
+FRESULT datalog_open(const __code char* path, uint32_t size) {
+    __xdata static DWORD sect, count;
+    __xdata static struct datalog_header other;
+    uint8_t valid;
+    FRESULT res;
+
+    dl.open = 0;
+    res = pf_fopen(&dl.file, path);
+    if (res == FR_OK && dl.file.fsize < size + 1024) {
+        res = pf_fexpand(&dl.file, size + 1024);
+    }
+    if (res == FR_OK) {
+        res = pf_fextent(&dl.file, &sect, &count);
+    }
+    if (res != FR_OK) {
+        return res;
+    }
+    if (count > (dl.file.fsize + 511) / 512) {
+        count = (dl.file.fsize + 511) / 512;
+    }
+    if (count < 3) {
+        return FR_DISK_FULL;
+    }
+    dl.header = sect;
+    dl.data = sect + 2;
+    dl.sectors = count - 2;
+
+    // pick up where the last session left off from the newer valid header,
+    // or start a new log
+    if (disk_readp((__xdata uint8_t*) &dl.hdr, dl.header, 0, sizeof dl.hdr)
+            || disk_readp((__xdata uint8_t*) &other, dl.header + 1, 0, sizeof other)) {
+        return FR_DISK_ERR;
+    }
+    valid = datalog_valid(&dl.hdr);
+    if (datalog_valid(&other) && (!valid || (int32_t) (other.sequence - dl.hdr.sequence) > 0)) {
+        xmem_copy(&dl.hdr, &other, sizeof other);
+        valid = 1;
+    }
+    if (!valid) {
+        dl.hdr.magic[0] = 'D';
+        dl.hdr.magic[1] = 'L';
+        dl.hdr.magic[2] = 'O';
+        dl.hdr.magic[3] = 'G';
+        dl.hdr.sequence = 0;
+        dl.hdr.sectors = dl.sectors;
+        if (datalog_commit(0)) {
+            return FR_DISK_ERR;
+        }
+    }
+
+    // reload a partly filled last sector so appending carries on inside it
+    dl.active = 0;
+    dl.start = dl.hdr.committed & ~511UL;
+    dl.fill = (uint16_t) dl.hdr.committed & 511;
+    if (dl.fill && disk_readp(datalog_buf[0], dl.data + dl.start / 512, 0, dl.fill)) {
+        return FR_DISK_ERR;
+    }
+
+    dl.pending = 0;
+    dl.error = 0;
+    PT_INIT(&dl.pt);
+    dl.open = 1;
+    return FR_OK;
+}
+
+uint8_t datalog_append(const __xdata void* record, uint16_t len) {
+    const __xdata uint8_t* src = record;
+    __xdata uint8_t* dst;
+
+    // all or nothing, filling the buffer means handing it over
+    if (!dl.open || dl.error || len > DATALOG_BUF_SIZE
+            || dl.start + dl.fill + len > dl.sectors * 512
+            || (len >= DATALOG_BUF_SIZE - dl.fill && dl.pending)) {
+        datalog_dropped++;
+        return 1;
+    }
+
+    dst = &datalog_buf[dl.active][dl.fill];
+    while (len--) {
+        *(dst++) = *(src++);
+        if (++dl.fill == DATALOG_BUF_SIZE) {
+            datalog_hand_over();
+            dst = datalog_buf[dl.active];
+        }
+    }
+    datalog_records++;
+    return 0;
+}
+
+static PT_THREAD(datalog_writer(__xdata struct pt* pt)) {
+    __xdata static const __xdata uint8_t* p;
+    __xdata static uint8_t n;
+
+    PT_BEGIN(pt);
+    while (1) {
+        PT_WAIT_UNTIL(pt, dl.pending);
+
+        // one multiple block write per buffer, then commit it. pff mustn't
+        // keep copies of the sectors it overwrites.
+        n = (dl.pend_bytes + 511) / 512;
+        p = datalog_buf[dl.pend_buf];
+        pf_invalidate(dl.data + dl.pend_start / 512, n);
+        if (disk_write_start(dl.data + dl.pend_start / 512, n)) {
+            break;
+        }
+        do {
+            timer_arm(TIMER_SD_BUSY, SD_WRITE_TIMEOUT);
+            PT_WAIT_WHILE(pt, disk_busy() && !timer_expired(TIMER_SD_BUSY));
+            if (disk_busy()) {
+                disk_write_stop();
+                break;
+            }
+            // a rejected block ends the transfer
+            if (disk_write_block(p)) {
+                break;
+            }
+            p += 512;
+        } while (--n);
+        if (n || disk_write_stop() || datalog_commit(dl.pend_start + dl.pend_bytes)) {
+            break;
+        }
+        datalog_buffers++;
+        dl.pending = 0;
+    }
+
+    // disk error, the log stays as it was last committed
+    dl.error = 1;
+    dl.pending = 0;
+    PT_END(pt);
+}
+
+uint8_t datalog_poll(void) {
+    datalog_writer(&dl.pt);
+    return dl.error;
+}
+
+FRESULT datalog_sync(void) {
+    uint16_t keep;
+
+    if (!dl.open) {
+        return FR_NOT_OPENED;
+    }
+    while (dl.pending) {
+        datalog_poll();
+    }
+    if (dl.fill && !dl.error) {
+        keep = dl.fill & 511;
+        datalog_hand_over();
+        while (dl.pending) {
+            datalog_poll();
+        }
+
+        // carry on filling the partly written last sector
+        if (keep) {
+            dl.start -= keep;
+            dl.fill = keep;
+            xmem_copy(datalog_buf[dl.active], &datalog_buf[dl.pend_buf][dl.pend_bytes - keep], keep);
+        }
+    }
+    return dl.error ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT datalog_close(void) {
+    FRESULT res = datalog_sync();
+    dl.open = 0;
+    return res;
+}
+
+PT_THREAD(datalog_task(__xdata struct pt* pt)) {
+    PT_BEGIN(pt);
+    while (dl.open) {
+        datalog_poll();
+        PT_YIELD(pt);
+    }
+    PT_END(pt);
+}
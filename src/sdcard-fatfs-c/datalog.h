@@ -0,0 +1,59 @@
+#ifndef DATALOG_H
+#define DATALOG_H
+
+#include <stdint.h>
+
+#include "pff.h"
+#include "pt.h"
+
+// append only log in a preallocated, contiguous file. the first two sectors
+// of the file are headers holding the number of bytes committed; the rest is
+// record data written a buffer at a time with multiple block writes, so a
+// power loss costs at most the buffers that hadn't been committed yet.
+// commits alternate between the two headers and opening takes the newest
+// valid one, so a header torn by a power loss leaves the one before it.
+
+// sectors per buffer, there are two of them
+#ifndef DATALOG_BUF_SECTORS
+#define DATALOG_BUF_SECTORS 4
+#endif
+
+#define DATALOG_BUF_SIZE (DATALOG_BUF_SECTORS * 512)
+
+struct datalog_header {
+    uint8_t magic[4];       // "DLOG"
+    uint32_t committed;     // bytes of record data on the card
+    uint32_t sequence;      // incremented on every header write, odd ones
+                            // go in the second header sector
+    uint32_t sectors;       // record data sectors in the file
+};
+
+// counters for benchmarks
+extern __xdata uint32_t datalog_records;
+extern __xdata uint32_t datalog_dropped;
+extern __xdata uint32_t datalog_buffers;
+
+// open the log, preallocating it to hold size bytes of records if it's
+// smaller. appending resumes after the last committed byte. FR_DENIED means
+// the card has the space but not in one piece, FR_DISK_FULL that it hasn't.
+FRESULT datalog_open(const __code char* path, uint32_t size);
+
+// append a record of at most DATALOG_BUF_SIZE bytes. returns nonzero and
+// counts it as dropped if there's no buffer free or the log is full.
+uint8_t datalog_append(const __xdata void* record, uint16_t len);
+
+// move the writer along without blocking, returns nonzero on a disk error
+uint8_t datalog_poll(void);
+
+// write and commit everything appended so far, blocks
+FRESULT datalog_sync(void);
+
+// sync, then let datalog_task end
+FRESULT datalog_close(void);
+
+// writer for the scheduler. it holds the sd card between the blocks of a
+// buffer, so it must not be idle safe and nothing else may use the card
+// while the log is open.
+PT_THREAD(datalog_task(__xdata struct pt* pt));
+
+#endif /* DATALOG_H */
@@ -3,6 +3,8 @@
 /*-----------------------------------------------------------------------*/
 
 #include "diskio.h"
+#include "task.h"
+#include "timer.h"
 
 #include <8051.h>
 
@@ -40,9 +42,6 @@ inline uint8_t spi_transfer_fast(uint8_t b) {
     return spi.data;
 }
 
-// timing
-extern volatile uint32_t centiseconds;
-
 #define SD_CARD_SELECT 3
 
 #define SD_CARD_CMD0 0x00
@@ -61,36 +60,75 @@ extern volatile uint32_t centiseconds;
 
 #define SD_CARD_DATA_BLOCK_START 0xFE
 
+#define SD_CARD_CMD12 0x0C
+#define SD_CARD_CMD17 0x11
+#define SD_CARD_CMD18 0x12
+#define SD_CARD_CMD24 0x18
+#define SD_CARD_CMD25 0x19
+#define SD_CARD_ACMD23 0x17
+
+#define SD_CARD_MULTI_BLOCK_START 0xFC
+#define SD_CARD_MULTI_BLOCK_STOP 0xFD
+
+#define SD_CARD_DATA_RESPONSE_MASK 0x1F
+#define SD_CARD_DATA_ACCEPTED 0x05
+
+// default for disk_early_stop, stopping a transfer costs about a dozen
+// byte times for CMD12 and its response plus the card's busy time
+#ifndef SD_EARLY_STOP
+#define SD_EARLY_STOP 64
+#endif
+
 static uint8_t sd_ver2 = 0;
 static uint8_t sd_hc = 0;
 
-inline uint8_t sd_wait_busy(uint8_t timeout) __reentrant {
+// destination of forwarded reads
+static DSINK sd_sink = 0;
+
+// statistics
+__xdata DWORD disk_read_count = 0;
+__xdata DWORD disk_stop_count = 0;
+__xdata DWORD disk_write_count = 0;
+
+// block write in progress and the number of bytes it still expects
+static __bit sd_writing;
+static UINT sd_write_left;
+
+// reads leaving more than this many bytes of the block unread are stopped early
+__xdata UINT disk_early_stop = SD_EARLY_STOP;
+
+inline uint8_t sd_wait_busy(uint8_t timeout) PF_SD_REENTRANT {
     // early success path
     if (spi_transfer(0xFF) == 0xFF) {
         return 0;
     }
 
-    uint32_t start = centiseconds;
-    do {
+    timer_arm(TIMER_SD_BUSY, timeout);
+    do { // @loop
         if (spi_transfer(0xFF) == 0xFF) {
             return 0;
         }
-    } while ((centiseconds - start) < timeout);
+        task_idle();
+    } while (!timer_expired(TIMER_SD_BUSY));
     return 1;
 }
 
-inline uint8_t sd_wait_block_start(uint8_t timeout) __reentrant {
+inline uint8_t sd_wait_block_start(uint8_t timeout) PF_SD_REENTRANT {
     // early success path
     if (spi_transfer(0xFF) == SD_CARD_DATA_BLOCK_START) {
         return 0;
     }
 
     // wait while idle
-    uint32_t start = centiseconds;
     uint8_t response;
+    timer_arm(TIMER_SD_BUSY, timeout);
     do {
         response = spi_transfer(0xFF);
-    } while ((response == 0xFF) && (centiseconds - start) < timeout);
+        if (response != 0xFF) {
+            break;
+        }
+        task_idle();
+    } while (!timer_expired(TIMER_SD_BUSY));
 
     // return success, hopefully
     if (response == SD_CARD_DATA_BLOCK_START) {
@@ -101,7 +139,7 @@ inline uint8_t sd_wait_block_start(uint8_t timeout) __reentrant {
     }
 }
 
-uint8_t sd_cmd(uint8_t command, uint32_t argument) __reentrant {
+uint8_t sd_cmd(uint8_t command, uint32_t argument) PF_REENTRANT {
     // select card
     spi.control.ss = SD_CARD_SELECT;
     sd_wait_busy(30);
@@ -133,7 +171,33 @@ uint8_t sd_cmd(uint8_t command, uint32_t argument) __reentrant {
     return response;
 }
 
-inline uint8_t sd_acmd(uint8_t command, uint32_t argument) __reentrant {
+// abort a multiple block read in the middle of a block. sd_cmd() can't be
+// used as the busy wait would clock through the rest of the data.
+uint8_t sd_stop_transmission(void) PF_REENTRANT {
+    spi_transfer(0x40 | SD_CARD_CMD12);
+    spi_transfer(0);
+    spi_transfer(0);
+    spi_transfer(0);
+    spi_transfer(0);
+    spi_transfer(0xFF);
+
+    // discard the stuff byte, then await response
+    spi_transfer(0xFF);
+    uint8_t i = 255;
+    uint8_t response = 255;
+    do {
+        response = spi_transfer(0xFF);
+    } while ((response & 0x80) && --i);
+
+    // card holds the line low until it has stopped
+    if (sd_wait_busy(30)) {
+        response = 0xFF;
+    }
+    spi.control.ss = 0;
+    return response;
+}
+
+inline uint8_t sd_acmd(uint8_t command, uint32_t argument) PF_REENTRANT {
     sd_cmd(55, 0);
     return sd_cmd(command, argument);
 }
@@ -202,7 +266,7 @@ uint32_t sd_size() {
 /* Initialize Disk Drive                                                 */
 /*-----------------------------------------------------------------------*/
 
-DSTATUS disk_initialize (void) __reentrant
+DSTATUS disk_initialize (void) PF_REENTRANT
 {
     // clear flags, set prescaler to clk / 128
     spi.control.value = 0x80;
@@ -215,10 +279,10 @@ DSTATUS disk_initialize (void) __reentrant
 
     // send CMD0 to reset SD card
     uint8_t response = 0;
-    uint32_t now = centiseconds;
+    //timer_arm(TIMER_SD_CMD, 100);
     //do {
         response = sd_cmd(SD_CARD_CMD0, 0);
-    //} while (response != SD_CARD_R1_IDLE_STATE && (centiseconds - now) < 100);
+    //} while (response != SD_CARD_R1_IDLE_STATE && !timer_expired(TIMER_SD_CMD));
     if (response != SD_CARD_R1_IDLE_STATE) {
 #ifndef DISKIO_DEBUG
         printf_tiny("failed to enter idle state\r\n");
@@ -253,10 +317,10 @@ DSTATUS disk_initialize (void) __reentrant
     }
 
     // put card in ready state
-    now = centiseconds;
+    timer_arm(TIMER_SD_CMD, 100);
     do {
         response = sd_acmd(41, sd_ver2 ? 0x40000000 : 0);
-    } while (response && (centiseconds - now) < 100);
+    } while (response && !timer_expired(TIMER_SD_CMD));
     if (response) {
 #ifndef DISKIO_DEBUG
         printf_tiny("failed to enter ready state\r\n");
@@ -297,10 +361,10 @@ DRESULT disk_readp (
 	DWORD sector,	/* Sector number (LBA) */
 	UINT offset,	/* Offset in the sector */
 	UINT count		/* Byte count (bit15:destination) */
-) __reentrant
+) PF_SD_REENTRANT
 {
     // sanity check
-    if (count + offset > 512) {
+    if (count + offset > 512 || (!buff && !sd_sink)) {
         return RES_PARERR;
     }
 
@@ -309,8 +373,13 @@ DRESULT disk_readp (
         sector <<= 9;
     }
 
+    // a read that ends well before the end of the block is started as a
+    // multiple block read so it can be cut short with CMD12
+    uint8_t early = disk_early_stop && 512 - offset - count > disk_early_stop;
+
     // start read
-    if (sd_cmd(17, sector)) {
+    disk_read_count++;
+    if (sd_cmd(early ? SD_CARD_CMD18 : SD_CARD_CMD17, sector)) {
         spi.control.ss = 0;
         return 1;
     }
@@ -322,19 +391,32 @@ DRESULT disk_readp (
 
     // skip over offset
     uint16_t i = 0;
-    while (offset--) {
+    while (offset--) { // @loop
         spi_transfer_fast(0xFF);
         i++;
     }
 
-    // read in data
-    while (count--) {
-        *(buff++) = spi_transfer_fast(0xFF);
-        i++;
+    // read in data, or hand it straight to the sink
+    if (buff) {
+        while (count--) { // @loop
+            *(buff++) = spi_transfer_fast(0xFF);
+            i++;
+        }
+    } else {
+        while (count--) { // @loop
+            sd_sink(spi_transfer_fast(0xFF));
+            i++;
+        }
+    }
+
+    // stop the transfer right away
+    if (early) {
+        disk_stop_count++;
+        return sd_stop_transmission() ? RES_ERROR : RES_OK;
     }
 
     // skip trailing and dump crc
-    while (i++ < 514) {
+    while (i++ < 514) { // @loop
         spi_transfer_fast(0xFF);
     }
     spi.control.ss = 0;
@@ -343,6 +425,19 @@ DRESULT disk_readp (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Set Forwarding Sink                                                   */
+/*-----------------------------------------------------------------------*/
+
+void disk_set_sink (
+	DSINK sink		/* Function to receive forwarded data, NULL to disable */
+) PF_REENTRANT
+{
+    sd_sink = sink;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Write Partial Sector                                                  */
 /*-----------------------------------------------------------------------*/
@@ -350,28 +445,138 @@ DRESULT disk_readp (
 DRESULT disk_writep (
 	const __xdata BYTE* buff,	/* Pointer to the data to be written, NULL:Initiate/Finalize write operation */
 	DWORD sc			/* Sector number (LBA) or Number of bytes to send */
-) __reentrant
+) PF_REENTRANT
 {
-	/*DRESULT res;
+    if (buff) {
+        // send data to the card
+        if (sc > sd_write_left) {
+            return RES_PARERR;
+        }
+        sd_write_left -= sc;
+        while (sc--) {
+            spi_transfer_fast(*(buff++));
+        }
+        return RES_OK;
+    }
 
+    if (sc) {
+        // initiate write, byte addressing if not SDHC
+        if (!sd_hc) {
+            sc <<= 9;
+        }
+        disk_write_count++;
+        if (sd_cmd(SD_CARD_CMD24, sc)) {
+            spi.control.ss = 0;
+            return RES_ERROR;
+        }
+        spi_transfer(0xFF);
+        spi_transfer(SD_CARD_DATA_BLOCK_START);
+        sd_write_left = 512;
+        sd_writing = 1;
+        return RES_OK;
+    }
+
+    // finalize, nothing to do if no write was started
+    if (!sd_writing) {
+        return RES_OK;
+    }
+    sd_writing = 0;
+
+    // pad the block with zeros and send a dummy crc
+    while (sd_write_left) {
+        spi_transfer_fast(0);
+        sd_write_left--;
+    }
+    spi_transfer(0xFF);
+    spi_transfer(0xFF);
+
+    // check the data response token, then wait for the card to program it
+    uint8_t response = spi_transfer(0xFF);
+    if ((response & SD_CARD_DATA_RESPONSE_MASK) != SD_CARD_DATA_ACCEPTED
+            || sd_wait_busy(SD_WRITE_TIMEOUT)) {
+        spi.control.ss = 0;
+        return RES_ERROR;
+    }
+    spi.control.ss = 0;
+    return RES_OK;
+}
 
-	if (!buff) {
-		if (sc) {
 
-			// Initiate write process
 
-		} else {
 
-			// Finalize write process
+/*-----------------------------------------------------------------------*/
+/* Multiple Block Write                                                  */
+/*-----------------------------------------------------------------------*/
+/* The card stays selected from disk_write_start() to disk_write_stop(), so
+/  nothing else may use it in between. disk_write_block() returns as soon
+/  as the card has accepted the data; poll disk_busy() before sending the
+/  next block to overlap the card's programming time with other work. If the
+/  card rejects a block, disk_write_block() ends the transfer itself with the
+/  stop token and deselects the card, so disk_write_stop() is not called. */
+
+DRESULT disk_write_start (
+	DWORD sector,	/* First sector number (LBA) */
+	UINT count		/* Number of sectors that will be written, for pre-erase */
+) PF_REENTRANT
+{
+    // pre-erase hint, failure is harmless
+    if (count > 1) {
+        sd_acmd(SD_CARD_ACMD23, count);
+    }
+
+    if (!sd_hc) {
+        sector <<= 9;
+    }
+    if (sd_cmd(SD_CARD_CMD25, sector)) {
+        spi.control.ss = 0;
+        return RES_ERROR;
+    }
+    spi_transfer(0xFF);
+    return RES_OK;
+}
+
+
+BYTE disk_busy (void) PF_SD_REENTRANT
+{
+    return spi_transfer(0xFF) != 0xFF;
+}
 
-		}
-	} else {
 
-		// Send data to the disk
+DRESULT disk_write_block (
+	const __xdata BYTE* buff	/* 512 bytes to be written */
+) PF_SD_REENTRANT
+{
+    uint16_t i = 512;
 
-	}
+    disk_write_count++;
+    spi_transfer(SD_CARD_MULTI_BLOCK_START);
+    do {
+        spi_transfer_fast(*(buff++));
+    } while (--i);
+    spi_transfer(0xFF);
+    spi_transfer(0xFF);
 
-	return res;*/
-	return RES_NOTRDY;
+    if ((spi_transfer(0xFF) & SD_CARD_DATA_RESPONSE_MASK) != SD_CARD_DATA_ACCEPTED) {
+        // the card is still in receive state, take it out of it
+        disk_write_stop();
+        return RES_ERROR;
+    }
+    return RES_OK;
 }
 
+
+DRESULT disk_write_stop (void) PF_REENTRANT
+{
+    DRESULT res = RES_OK;
+
+    if (sd_wait_busy(SD_WRITE_TIMEOUT)) {
+        res = RES_ERROR;
+    }
+    spi_transfer(SD_CARD_MULTI_BLOCK_STOP);
+    spi_transfer(0xFF);
+    if (sd_wait_busy(SD_WRITE_TIMEOUT)) {
+        res = RES_ERROR;
+    }
+    spi.control.ss = 0;
+    return res;
+}
@@ -27,12 +27,39 @@ typedef enum {
 } DRESULT;
 
 
+/* Sink for data read with a NULL buffer (forwarding mode). Each byte is
+/  handed over as soon as it has been clocked in from the card. XRAM address
+/  0 is kept free by the linker settings so a NULL buffer can't alias a real
+/  one. */
+typedef void (*DSINK)(BYTE d);
+
+
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
 
-DSTATUS disk_initialize (void) __reentrant;
-DRESULT disk_readp (__xdata BYTE* buff, DWORD sector, UINT offser, UINT count) __reentrant;
-DRESULT disk_writep (const __xdata BYTE* buff, DWORD sc) __reentrant;
+DSTATUS disk_initialize (void) PF_REENTRANT;
+DRESULT disk_readp (__xdata BYTE* buff, DWORD sector, UINT offser, UINT count) PF_SD_REENTRANT;
+DRESULT disk_writep (const __xdata BYTE* buff, DWORD sc) PF_REENTRANT;
+void disk_set_sink (DSINK sink) PF_REENTRANT;
+DRESULT disk_write_start (DWORD sector, UINT count) PF_REENTRANT;
+BYTE disk_busy (void) PF_SD_REENTRANT;
+DRESULT disk_write_block (const __xdata BYTE* buff) PF_SD_REENTRANT;
+DRESULT disk_write_stop (void) PF_REENTRANT;
+
+/* Ticks of TIMER_SD_BUSY to allow for a card programming a block, also for
+/  callers polling disk_busy() in a multiple block write */
+#define SD_WRITE_TIMEOUT	50
+
+/* Number of sector reads issued to the card, how many of them were
+/  stopped early with CMD12, and number of sector writes, for benchmarks */
+extern __xdata DWORD disk_read_count;
+extern __xdata DWORD disk_stop_count;
+extern __xdata DWORD disk_write_count;
+
+/* Reads leaving more than this many bytes of the sector unread use CMD18
+/  and are stopped with CMD12 right after the data. 0 always reads the
+/  whole sector with CMD17. */
+extern __xdata UINT disk_early_stop;
 
 #define STA_NOINIT		0x01	/* Drive not initialized */
 #define STA_NODISK		0x02	/* No medium in the drive */
@@ -0,0 +1,318 @@
+/*-----------------------------------------------------------------------*/
+/* Simulated disk for Petit FatFs benchmarks in ucsim                    */
+/*-----------------------------------------------------------------------*/
+
+// the simulator has no sd card behind the spi port, so this stands in for
+// diskio.c and makes up a fat volume on the fly. SIM_FAT picks fat12 (8 MiB),
+// fat16 (128 MiB) or fat32 (512 MiB). the root directory holds
+//
+//   STREAM.BIN  64 KiB, contiguous from cluster 3
+//   A.BIN       16 KiB, contiguous after it
+//
+// file bytes are made up as tools/mkfatimg.py writes them, byte i of a file
+// being (i ^ (i >> 8) ^ seed) & 0xFF with seeds 1 and 2 in the order above,
+// so reads can be checked. nothing can be stored, so writes are compared
+// with the volume instead and fail if they would change it. the cost of
+// making the bytes up replaces the cost of clocking them off the card, so
+// only compare numbers between builds, not with the hardware. layouts other
+// than these two contiguous files are run on mkfatimg images by
+// host/bench.c.
+
+#include "diskio.h"
+
+#ifndef SIM_FAT
+#define SIM_FAT         32
+#endif
+
+#if SIM_FAT == 12
+#define SIM_SECTORS     16384UL         // 2042 clusters
+#define SIM_RESERVED    1
+#define SIM_FAT_SIZE    6UL             // sectors per fat
+#define SIM_ROOT_ENTRIES 512
+#elif SIM_FAT == 16
+#define SIM_SECTORS     262144UL        // 32731 clusters
+#define SIM_RESERVED    1
+#define SIM_FAT_SIZE    128UL
+#define SIM_ROOT_ENTRIES 512
+#elif SIM_FAT == 32
+#define SIM_SECTORS     1048576UL       // 130812 clusters
+#define SIM_RESERVED    32
+#define SIM_FAT_SIZE    1024UL
+#define SIM_ROOT_ENTRIES 0              // in cluster 2
+#else
+#error SIM_FAT must be 12, 16 or 32
+#endif
+
+#define SIM_CLUSTER     8               // sectors per cluster
+#define SIM_FATS        2
+#define SIM_FAT_BASE    SIM_RESERVED
+#define SIM_ROOT_BASE   (SIM_FAT_BASE + SIM_FATS * SIM_FAT_SIZE)
+#define SIM_DATA_BASE   (SIM_ROOT_BASE + SIM_ROOT_ENTRIES / 16)
+#if SIM_FAT == 32
+#define SIM_ROOT_SECTOR SIM_DATA_BASE
+#else
+#define SIM_ROOT_SECTOR SIM_ROOT_BASE
+#endif
+
+// files, first cluster and length in clusters
+#define SIM_STREAM_CLUST    3
+#define SIM_STREAM_CLUSTS   16
+#define SIM_A_CLUST         (SIM_STREAM_CLUST + SIM_STREAM_CLUSTS)
+#define SIM_A_CLUSTS        4
+#define SIM_LAST_CLUST      (SIM_A_CLUST + SIM_A_CLUSTS - 1)
+
+#define SIM_LE16(x)     ((x) & 0xFF), (((x) >> 8) & 0xFF)
+#define SIM_LE32(x)     SIM_LE16(x), SIM_LE16((x) >> 16)
+
+// boot sector up to the file system type
+static __code const BYTE sim_boot[] = {
+    0xEB, 0x58, 0x90, 'M', 'S', 'W', 'I', 'N', '4', '.', '1',
+    SIM_LE16(512),              // bytes per sector
+    SIM_CLUSTER,                // sectors per cluster
+    SIM_LE16(SIM_RESERVED),     // reserved sectors
+    SIM_FATS,                   // number of fats
+    SIM_LE16(SIM_ROOT_ENTRIES), // root entries
+    SIM_LE16(0),                // total sectors 16 (see 32)
+    0xF8,                       // media
+#if SIM_FAT == 32
+    SIM_LE16(0),                // sectors per fat 16
+#else
+    SIM_LE16(SIM_FAT_SIZE),
+#endif
+    0x3F, 0x00, 0xFF, 0x00,     // geometry
+    SIM_LE32(0),                // hidden sectors
+    SIM_LE32(SIM_SECTORS),      // total sectors 32
+#if SIM_FAT == 32
+    SIM_LE32(SIM_FAT_SIZE),     // sectors per fat 32
+    SIM_LE16(0), SIM_LE16(0),   // flags, version
+    SIM_LE32(2),                // root directory cluster
+    SIM_LE16(0),                // fsinfo sector (none)
+    SIM_LE16(0),                // backup boot sector (none)
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+#endif
+    0x80, 0x00, 0x29,           // drive, reserved, extended signature
+    SIM_LE32(0x001EA751),       // volume id
+    'S', 'I', 'M', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+#if SIM_FAT == 12
+    'F', 'A', 'T', '1', '2', ' ', ' ', ' '
+#elif SIM_FAT == 16
+    'F', 'A', 'T', '1', '6', ' ', ' ', ' '
+#else
+    'F', 'A', 'T', '3', '2', ' ', ' ', ' '
+#endif
+};
+
+// root directory entries
+static __code const BYTE sim_root[2][32] = {
+    { 'S', 'T', 'R', 'E', 'A', 'M', ' ', ' ', 'B', 'I', 'N', 0x20,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      SIM_LE16(SIM_STREAM_CLUST),
+      SIM_LE32(SIM_STREAM_CLUSTS * SIM_CLUSTER * 512UL) },
+    { 'A', ' ', ' ', ' ', ' ', ' ', ' ', ' ', 'B', 'I', 'N', 0x20,
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      SIM_LE16(SIM_A_CLUST),
+      SIM_LE32(SIM_A_CLUSTS * SIM_CLUSTER * 512UL) }
+};
+
+static DSINK sim_sink = 0;
+
+// statistics, as diskio.c
+__xdata DWORD disk_read_count = 0;
+__xdata DWORD disk_stop_count = 0;
+__xdata DWORD disk_write_count = 0;
+__xdata UINT disk_early_stop = 0;
+
+static UINT sim_write_left;
+static DWORD sim_write_sector;
+static DWORD sim_multi_sector;
+
+// fat entry of a cluster, end of chain is cut down to the entry width
+static DWORD sim_fat_entry(DWORD clust) {
+    if (clust > SIM_LAST_CLUST) {
+        return 0;
+    }
+    if (clust < 3 || clust == SIM_A_CLUST - 1 || clust == SIM_LAST_CLUST) {
+        return 0x0FFFFFFF;
+    }
+    return clust + 1;
+}
+
+// byte of a fat sector
+static BYTE sim_fat_byte(DWORD sector, UINT offset) {
+#if SIM_FAT == 12
+    DWORD b = sector * 512 + offset;
+    DWORD e = b / 3 * 2;
+
+    switch ((BYTE) (b % 3)) {
+    case 0:
+        return (BYTE) sim_fat_entry(e);
+    case 1:
+        return (BYTE) (sim_fat_entry(e) >> 8 & 0x0F) | (BYTE) (sim_fat_entry(e + 1) << 4);
+    default:
+        return (BYTE) (sim_fat_entry(e + 1) >> 4);
+    }
+#elif SIM_FAT == 16
+    return (BYTE) (sim_fat_entry(sector * 256 + offset / 2) >> ((offset & 1) * 8));
+#else
+    return (BYTE) (sim_fat_entry(sector * 128 + offset / 4) >> ((offset & 3) * 8));
+#endif
+}
+
+// byte of a file at an offset
+static BYTE sim_file_byte(DWORD ofs, BYTE seed) {
+    return (BYTE) ofs ^ (BYTE) (ofs >> 8) ^ seed;
+}
+
+// byte at an offset of a sector
+static BYTE sim_byte(DWORD sector, UINT offset) {
+    if (sector >= SIM_DATA_BASE + SIM_CLUSTER) {
+        sector -= SIM_DATA_BASE + (SIM_STREAM_CLUST - 2) * SIM_CLUSTER;
+        if (sector < SIM_STREAM_CLUSTS * SIM_CLUSTER) {
+            return sim_file_byte(sector * 512 + offset, 1);
+        }
+        sector -= SIM_STREAM_CLUSTS * SIM_CLUSTER;
+        if (sector < SIM_A_CLUSTS * SIM_CLUSTER) {
+            return sim_file_byte(sector * 512 + offset, 2);
+        }
+        return 0;
+    }
+    if (sector == SIM_ROOT_SECTOR) {
+        return offset < sizeof sim_root ? sim_root[offset / 32][offset % 32] : 0;
+    }
+    if (sector >= SIM_FAT_BASE && sector < SIM_ROOT_BASE) {
+        return sim_fat_byte((sector - SIM_FAT_BASE) % SIM_FAT_SIZE, offset);
+    }
+    if (sector == 0) {
+        if (offset < sizeof sim_boot) {
+            return sim_boot[offset];
+        }
+        if (offset == 510) {
+            return 0x55;
+        }
+        if (offset == 511) {
+            return 0xAA;
+        }
+    }
+    return 0;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Initialize Disk Drive                                                 */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_initialize (void) PF_REENTRANT
+{
+    return 0;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Partial Sector                                                   */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_readp (
+	__xdata BYTE* buff,		/* Pointer to the destination object (NULL:Forward to the sink) */
+	DWORD sector,	/* Sector number (LBA) */
+	UINT offset,	/* Offset in the sector */
+	UINT count		/* Byte count (bit15:destination) */
+) PF_SD_REENTRANT
+{
+    if (sector >= SIM_SECTORS || count + offset > 512) {
+        return RES_PARERR;
+    }
+    disk_read_count++;
+    while (count--) {
+        if (buff) {
+            *(buff++) = sim_byte(sector, offset++);
+        } else {
+            sim_sink(sim_byte(sector, offset++));
+        }
+    }
+    return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write Partial Sector                                                  */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_writep (
+	const __xdata BYTE* buff,	/* Pointer to the data to be written, NULL:Initiate/Finalize write operation */
+	DWORD sc		/* Sector number (LBA) or Number of bytes to send */
+) PF_REENTRANT
+{
+    if (!buff) {
+        if (sc) {
+            if (sc >= SIM_SECTORS) {
+                return RES_PARERR;
+            }
+            sim_write_sector = sc;
+            sim_write_left = 512;
+        } else {
+            sim_write_left = 0;
+            disk_write_count++;
+        }
+        return RES_OK;
+    }
+    if (sc > sim_write_left) {
+        return RES_PARERR;
+    }
+    while (sc--) {
+        if (*(buff++) != sim_byte(sim_write_sector, 512 - sim_write_left)) {
+            return RES_ERROR;
+        }
+        sim_write_left--;
+    }
+    return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Multiple Block Writes                                                 */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_write_start (DWORD sector, UINT count) PF_REENTRANT
+{
+    sim_multi_sector = sector;
+    return sector + count > SIM_SECTORS ? RES_PARERR : RES_OK;
+}
+
+BYTE disk_busy (void) PF_SD_REENTRANT
+{
+    return 0;
+}
+
+DRESULT disk_write_block (const __xdata BYTE* buff) PF_SD_REENTRANT
+{
+    UINT i;
+
+    for (i = 0; i != 512; i++) {
+        if (*(buff++) != sim_byte(sim_multi_sector, i)) {
+            return RES_ERROR;
+        }
+    }
+    sim_multi_sector++;
+    disk_write_count++;
+    return RES_OK;
+}
+
+DRESULT disk_write_stop (void) PF_REENTRANT
+{
+    return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Forwarding Sink                                                       */
+/*-----------------------------------------------------------------------*/
+
+void disk_set_sink (DSINK sink) PF_REENTRANT
+{
+    sim_sink = sink;
+}
@@ -0,0 +1,199 @@
+/*-----------------------------------------------------------------------*/
+/* Paged random access to a file for Petit FatFs                         */
+/*-----------------------------------------------------------------------*/
+
+#include "fpage.h"
+
+#include "xmem.h"
+
+#if FPAGE_PAGES < 1 || FPAGE_PAGES > 8
+#error FPAGE_PAGES must be 1..8
+#endif
+
+// pages are loaded with pf_flseek(), so there is no pager without it
+#if PF_USE_LSEEK
+
+// make a page the most recently used one
+static void fpage_touch(__xdata FPAGER* pg, BYTE n) {
+    BYTE age = pg->age[n];
+    BYTE i;
+
+    for (i = 0; i != FPAGE_PAGES; i++) {
+        if (pg->age[i] < age) {
+            pg->age[i]++;
+        }
+    }
+    pg->age[n] = 0;
+    pg->last = n;
+}
+
+// load a page of the file into the oldest slot, returns the slot or
+// FPAGE_PAGES on a disk error. loading page n leaves the file pointer at the
+// start of page n + 1, so sequential and forward strided access only ever
+// walks the cluster chain forwards from where it already is.
+static BYTE fpage_load(__xdata FPAGER* pg, DWORD page) {
+    __xdata static UINT br;
+    BYTE i, n = 0;
+
+    for (i = 0; i != FPAGE_PAGES; i++) {
+        if (!(pg->valid & (1 << i))) {
+            n = i;
+            break;
+        }
+        if (pg->age[i] > pg->age[n]) {
+            n = i;
+        }
+    }
+
+    pg->valid &= ~(1 << n);
+    if (pf_flseek(pg->fp, page * 512) != FR_OK || pf_fread(pg->fp, pg->data[n], 512, &br) != FR_OK) {
+        return FPAGE_PAGES;
+    }
+    pg->page[n] = page;
+    pg->valid |= 1 << n;
+    return n;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Attach a Pager to an Open File                                        */
+/*-----------------------------------------------------------------------*/
+
+FRESULT fpage_open (
+	__xdata FPAGER* pg,		/* Pager to set up */
+	__xdata FIL* fp			/* File opened with pf_fopen() */
+) PF_REENTRANT
+{
+    BYTE i;
+
+    pg->fp = fp;
+    pg->valid = 0;
+    pg->last = 0;
+    for (i = 0; i != FPAGE_PAGES; i++) {
+        pg->age[i] = i;
+    }
+    return pf_flseek(fp, 0);    // also checks the file is open
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get a Pointer into a Resident Page                                    */
+/*-----------------------------------------------------------------------*/
+
+__xdata BYTE* fpage_get (		/* Pointer to the byte at ofs, 0:Disk error or past the end */
+	__xdata FPAGER* pg,		/* Pager */
+	DWORD ofs,				/* File offset */
+	__xdata UINT* avail		/* Number of bytes readable from the pointer within the page */
+) PF_REENTRANT
+{
+    DWORD page = ofs / 512;
+    DWORD remain;
+    BYTE n = pg->last;
+    BYTE i;
+
+    *avail = 0;
+    if (ofs >= pg->fp->fsize) {
+        return 0;
+    }
+
+    // the last page used is the likely one, then look through the rest
+    if (!(pg->valid & (1 << n)) || pg->page[n] != page) {
+        for (i = 0; i != FPAGE_PAGES; i++) {
+            if ((pg->valid & (1 << i)) && pg->page[i] == page) {
+                break;
+            }
+        }
+        n = i != FPAGE_PAGES ? i : fpage_load(pg, page);
+        if (n == FPAGE_PAGES) {
+            return 0;
+        }
+    }
+    fpage_touch(pg, n);
+
+    remain = pg->fp->fsize - ofs;
+    *avail = 512 - (UINT) ofs % 512;
+    if (*avail > remain) {
+        *avail = (UINT) remain;
+    }
+    return pg->data[n] + (UINT) ofs % 512;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get a Byte / Little Endian Word                                       */
+/*-----------------------------------------------------------------------*/
+
+FRESULT fpage_byte (
+	__xdata FPAGER* pg,		/* Pager */
+	DWORD ofs,				/* File offset */
+	__xdata BYTE* b			/* Byte read */
+) PF_REENTRANT
+{
+    __xdata static UINT avail;
+    __xdata BYTE* p = fpage_get(pg, ofs, &avail);
+
+    if (!p) {
+        return ofs >= pg->fp->fsize ? FR_OUT_OF_RANGE : FR_DISK_ERR;
+    }
+    *b = *p;
+    return FR_OK;
+}
+
+
+FRESULT fpage_word (
+	__xdata FPAGER* pg,		/* Pager */
+	DWORD ofs,				/* File offset */
+	__xdata WORD* w			/* Word read, may straddle two pages */
+) PF_REENTRANT
+{
+    __xdata static BYTE lo;
+    __xdata static BYTE hi;
+    FRESULT res;
+
+    res = fpage_byte(pg, ofs, &lo);
+    if (res == FR_OK) {
+        res = fpage_byte(pg, ofs + 1, &hi);
+    }
+    *w = (WORD) hi << 8 | lo;
+    return res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Copy a Span of Bytes                                                  */
+/*-----------------------------------------------------------------------*/
+
+FRESULT fpage_span (
+	__xdata FPAGER* pg,		/* Pager */
+	DWORD ofs,				/* File offset */
+	__xdata BYTE* buff,		/* Destination */
+	UINT btr,				/* Number of bytes to copy */
+	__xdata UINT* br		/* Number of bytes copied, short at the end of the file */
+) PF_REENTRANT
+{
+    __xdata static UINT avail;
+    __xdata BYTE* p;
+
+    *br = 0;
+    while (btr && ofs < pg->fp->fsize) {
+        p = fpage_get(pg, ofs, &avail);
+        if (!p) {
+            return FR_DISK_ERR;
+        }
+        if (avail > btr) {
+            avail = btr;
+        }
+        btr -= avail;
+        ofs += avail;
+        *br += avail;
+        xmem_copy(buff, p, avail);
+        buff += avail;
+    }
+    return FR_OK;
+}
+
+#endif
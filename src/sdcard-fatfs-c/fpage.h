@@ -0,0 +1,38 @@
+/*-----------------------------------------------------------------------
+/  Paged random access to a file opened with pf_fopen()
+/-----------------------------------------------------------------------*/
+
+#ifndef _FPAGE_DEFINED
+#define _FPAGE_DEFINED
+
+#include "pff.h"
+
+
+/* Number of resident 512 byte pages per pager, override from the Makefile.
+/  Each pager carries its own pages, so this is the XRAM cost per file. */
+#ifndef FPAGE_PAGES
+#define FPAGE_PAGES		4
+#endif
+
+/* Pager over one open file. Pages are loaded on demand with least
+/  recently used replacement. */
+typedef struct {
+	__xdata FIL* fp;				/* File being paged */
+	DWORD page[FPAGE_PAGES];		/* File offset / 512 held by each page */
+	BYTE valid;						/* Bit n set when page n holds data */
+	BYTE age[FPAGE_PAGES];			/* 0 is the most recently used page */
+	BYTE last;						/* Page that served the last access */
+	BYTE data[FPAGE_PAGES][512];	/* Page contents */
+} FPAGER;
+
+
+/*---------------------------------------*/
+/* Prototypes for pager functions        */
+
+FRESULT fpage_open (__xdata FPAGER* pg, __xdata FIL* fp) PF_REENTRANT;
+__xdata BYTE* fpage_get (__xdata FPAGER* pg, DWORD ofs, __xdata UINT* avail) PF_REENTRANT;
+FRESULT fpage_byte (__xdata FPAGER* pg, DWORD ofs, __xdata BYTE* b) PF_REENTRANT;
+FRESULT fpage_word (__xdata FPAGER* pg, DWORD ofs, __xdata WORD* w) PF_REENTRANT;
+FRESULT fpage_span (__xdata FPAGER* pg, DWORD ofs, __xdata BYTE* buff, UINT btr, __xdata UINT* br) PF_REENTRANT;
+
+#endif	/* _FPAGE_DEFINED */
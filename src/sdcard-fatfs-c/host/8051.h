@@ -0,0 +1,19 @@
+#ifndef HOST_8051_H
+#define HOST_8051_H
+
+// the special function registers the sources touch, as plain variables
+// defined in hal.c. the host build defines the sdcc storage classes away
+// (see Makefile), so __sfr and __sbit are declared here the same way.
+
+extern volatile unsigned char P0, P1, P2, P3, SP, DPL, DPH, PSW, ACC, B;
+extern volatile unsigned char TCON, TMOD, TL0, TL1, TH0, TH1, SCON, SBUF, IE, IP;
+extern volatile unsigned char TF0, TR0, TF1, TR1, IE0, IE1, IT0, IT1;
+extern volatile unsigned char EA, ES, ET0, ET1, EX0, EX1, RI, TI;
+
+#define IE0_VECTOR 0
+#define TF0_VECTOR 1
+#define IE1_VECTOR 2
+#define TF1_VECTOR 3
+#define SI0_VECTOR 4
+
+#endif /* HOST_8051_H */
@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "disk.h"
+#include "timebase.h"
+
+// simbench.c run natively against an image made by tools/mkfatimg.py, for
+// tools/pff-matrix.py. there is no cycle counter on the host, so the
+// timebase counts card transfers (disk_readp() calls and written sectors)
+// and every phase reports those instead.
+//
+//     ./bench card.img PATH SEED
+//
+// PATH is the 64 KiB file to run on and SEED its seed from the manifest.
+
+void simbench(const char* path, uint8_t seed);
+
+volatile uint32_t centiseconds;
+
+void timebase_setup(void) {
+}
+
+uint32_t timebase_ticks(void) {
+    return centiseconds;
+}
+
+uint32_t timebase_cycles(void) {
+    return disk_read_count + disk_write_count;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s IMAGE PATH SEED\n", argv[0]);
+        return 2;
+    }
+    disk_image = argv[1];
+    simbench(argv[2], (uint8_t) atoi(argv[3]));
+    printf("done\n");
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+#include <stdio.h>
+
+// failed checks are printed and counted, main() returns the count
+static unsigned failures;
+
+#define CHECK(cond) do {                                            \
+        if (!(cond)) {                                              \
+            printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                             \
+        }                                                           \
+    } while (0)
+
+#endif /* HOST_CHECK_H */
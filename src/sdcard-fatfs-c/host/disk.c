@@ -0,0 +1,136 @@
+#include "disk.h"
+
+#include <stdio.h>
+#include <string.h>
+
+const char* disk_image;
+uint32_t disk_fail_block;
+uint32_t disk_misuse;
+
+__xdata DWORD disk_read_count;
+__xdata DWORD disk_stop_count;
+__xdata DWORD disk_write_count;
+__xdata UINT disk_early_stop;
+
+static FILE* image;
+static DSINK sink;
+
+// single sector write from disk_writep()
+static BYTE sector_buf[512];
+static DWORD sector_lba;
+static UINT sector_fill;
+static uint8_t sector_open;
+
+// multiple block write
+static DWORD multi_lba;
+static uint8_t multi_open;
+
+static void check_idle(void) {
+    if (multi_open) {
+        disk_misuse++;
+    }
+}
+
+static DRESULT put_sector(const BYTE* buff, DWORD sector) {
+    if (fseek(image, (long) sector * 512, SEEK_SET) || fwrite(buff, 1, 512, image) != 512) {
+        return RES_ERROR;
+    }
+    return RES_OK;
+}
+
+DSTATUS disk_initialize(void) {
+    if (image) {
+        fclose(image);
+    }
+    image = fopen(disk_image, "r+b");
+    multi_open = 0;
+    sector_open = 0;
+    return image ? 0 : STA_NOINIT;
+}
+
+DRESULT disk_readp(BYTE* buff, DWORD sector, UINT offset, UINT count) {
+    BYTE data[512];
+    UINT i;
+
+    check_idle();
+    if (!image || offset + count > 512) {
+        return RES_PARERR;
+    }
+    disk_read_count++;
+    if (fseek(image, (long) sector * 512, SEEK_SET) || fread(data, 1, 512, image) != 512) {
+        return RES_ERROR;
+    }
+    if (buff) {
+        memcpy(buff, data + offset, count);
+    } else {
+        for (i = 0; i != count; i++) {
+            sink(data[offset + i]);
+        }
+    }
+    return RES_OK;
+}
+
+void disk_set_sink(DSINK s) {
+    sink = s;
+}
+
+DRESULT disk_writep(const BYTE* buff, DWORD sc) {
+    if (buff) {
+        if (!sector_open || sector_fill + sc > 512) {
+            return RES_PARERR;
+        }
+        memcpy(sector_buf + sector_fill, buff, sc);
+        sector_fill += sc;
+        return RES_OK;
+    }
+    if (sc) {
+        check_idle();
+        sector_lba = sc;
+        sector_fill = 0;
+        sector_open = 1;
+        return RES_OK;
+    }
+    if (!sector_open) {
+        return RES_PARERR;
+    }
+    memset(sector_buf + sector_fill, 0, 512 - sector_fill);
+    sector_open = 0;
+    disk_write_count++;
+    return put_sector(sector_buf, sector_lba);
+}
+
+DRESULT disk_write_start(DWORD sector, UINT count) {
+    (void) count;
+    check_idle();
+    multi_lba = sector;
+    multi_open = 1;
+    return RES_OK;
+}
+
+BYTE disk_busy(void) {
+    return 0;
+}
+
+DRESULT disk_write_block(const BYTE* buff) {
+    if (!multi_open) {
+        disk_misuse++;
+        return RES_ERROR;
+    }
+    if (disk_fail_block && !--disk_fail_block) {
+        // the driver ends the transfer itself when the card refuses a block
+        multi_open = 0;
+        return RES_ERROR;
+    }
+    disk_write_count++;
+    return put_sector(buff, multi_lba++);
+}
+
+DRESULT disk_write_stop(void) {
+    if (!multi_open) {
+        disk_misuse++;
+        return RES_ERROR;
+    }
+    multi_open = 0;
+    fflush(image);
+    return RES_OK;
+}
@@ -0,0 +1,22 @@
+#ifndef HOST_DISK_H
+#define HOST_DISK_H
+
+#include <stdint.h>
+
+#include "diskio.h"
+
+// the card for the host build, a disk image file as made by
+// tools/mkfatimg.py, sector 0 at the start of the file
+
+// image disk_initialize() opens
+extern const char* disk_image;
+
+// make the nth disk_write_block() from now fail, as if the card had
+// rejected the data. 0 never fails.
+extern uint32_t disk_fail_block;
+
+// commands sent while a multiple block write was still open, which a
+// real card would take as data
+extern uint32_t disk_misuse;
+
+#endif /* HOST_DISK_H */
@@ -0,0 +1,30 @@
+#include <8051.h>
+
+#include <stdint.h>
+
+#include "timebase.h"
+
+// register stand-ins for host/8051.h
+volatile unsigned char P0, P1, P2, P3, SP, DPL, DPH, PSW, ACC, B;
+volatile unsigned char TCON, TMOD, TL0, TL1, TH0, TH1, SCON, SBUF, IE, IP;
+volatile unsigned char TF0, TR0, TF1, TR1, IE0, IE1, IT0, IT1;
+volatile unsigned char EA, ES, ET0, ET1, EX0, EX1, RI, TI;
+
+// the timebase never ticks on the host, cycles just count calls so
+// differences stay positive
+volatile uint32_t centiseconds;
+static uint32_t cycles;
+
+void timebase_isr(void) {
+}
+
+void timebase_setup(void) {
+}
+
+uint32_t timebase_ticks(void) {
+    return centiseconds;
+}
+
+uint32_t timebase_cycles(void) {
+    return ++cycles;
+}
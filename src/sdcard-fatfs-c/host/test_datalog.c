@@ -0,0 +1,175 @@
+#include <string.h>
+
+#include "check.h"
+#include "datalog.h"
+#include "disk.h"
+#include "pff.h"
+
+// datalog.c on an image with an empty LOG.BIN made by tools/mkfatimg.py:
+// records survive closing and reopening the log, a torn newest header
+// leaves the commit before it and so does a block the card rejects. the
+// volume stays mounted throughout, so reading the records back through pff
+// also checks that the log's direct writes don't leave stale copies behind.
+
+#define LOG_SIZE 0x10000UL
+#define RECORD 37
+
+static FATFS fs;
+static DWORD header;
+static uint32_t written;    // log offset the next record starts at
+
+static uint8_t expected(uint32_t ofs) {
+    return (uint8_t) (ofs ^ (ofs >> 8) ^ 0x5A);
+}
+
+static void open_log(void) {
+    static FIL fil;
+    DWORD count;
+
+    CHECK(datalog_open("LOG.BIN", LOG_SIZE) == FR_OK);
+    CHECK(pf_fopen(&fil, "LOG.BIN") == FR_OK);
+    CHECK(pf_fextent(&fil, &header, &count) == FR_OK);
+}
+
+// the header sector holding the last commit, or the other one
+static void read_header(struct datalog_header* hdr, uint8_t newest) {
+    static struct datalog_header h[2];
+    uint8_t n;
+
+    CHECK(disk_readp((BYTE*) &h[0], header, 0, sizeof h[0]) == RES_OK);
+    CHECK(disk_readp((BYTE*) &h[1], header + 1, 0, sizeof h[1]) == RES_OK);
+    n = (int32_t) (h[1].sequence - h[0].sequence) > 0;
+    *hdr = h[newest ? n : !n];
+}
+
+static void append(uint32_t bytes) {
+    static uint8_t record[RECORD];
+    uint8_t i;
+
+    while (bytes >= RECORD) {
+        for (i = 0; i != RECORD; i++) {
+            record[i] = expected(written + i);
+        }
+        // wait for the writer, unless it has given up
+        while (datalog_append(record, RECORD)) {
+            if (datalog_poll()) {
+                return;
+            }
+        }
+        written += RECORD;
+        bytes -= RECORD;
+    }
+}
+
+// record data from the sector holding log offset from up to offset to, read
+// in pieces that don't line up with sectors so they go through pff's
+// buffers. the sector at from was read last time, if pff still has that
+// copy it is stale.
+static void check_data(uint32_t from, uint32_t to) {
+    static BYTE buffer[100];
+    uint32_t ofs = from & ~511UL, bad = 0;
+    UINT br, i;
+
+    CHECK(pf_open("LOG.BIN") == FR_OK);
+    CHECK(pf_lseek(1024 + ofs) == FR_OK);
+    while (ofs < to) {
+        CHECK(pf_read(buffer, sizeof buffer, &br) == FR_OK && br == sizeof buffer);
+        for (i = 0; i != sizeof buffer && ofs < to; i++, ofs++) {
+            bad += buffer[i] != expected(ofs);
+        }
+    }
+    CHECK(!bad);
+}
+
+static void persist(void) {
+    static const uint16_t sessions[] = {3000, 500, 700};
+    static struct datalog_header hdr;
+    uint32_t from;
+    uint8_t i;
+
+    open_log();
+    read_header(&hdr, 1);
+    CHECK(!memcmp(hdr.magic, "DLOG", 4));
+    CHECK(hdr.committed == 0);
+
+    append(5000);
+    CHECK(datalog_close() == FR_OK);
+    read_header(&hdr, 1);
+    CHECK(hdr.committed == written);
+    check_data(0, written);
+
+    // each session carries on inside the partly written last sector. the
+    // number of commits varies, so the newest header is in either sector.
+    for (i = 0; i != sizeof sessions / sizeof sessions[0]; i++) {
+        open_log();
+        from = written;
+        append(sessions[i]);
+        CHECK(datalog_close() == FR_OK);
+        read_header(&hdr, 1);
+        CHECK(hdr.committed == written);
+        check_data(from, written);
+    }
+}
+
+static void torn_header(void) {
+    static struct datalog_header newest, older;
+
+    read_header(&newest, 1);
+    read_header(&older, 0);
+    CHECK(older.sequence + 1 == newest.sequence);
+    CHECK(older.committed < newest.committed);
+
+    // a power loss while the newest header was written
+    CHECK(disk_writep(0, header + (newest.sequence & 1)) == RES_OK);
+    CHECK(disk_writep(0, 0) == RES_OK);
+
+    open_log();
+    written = older.committed;
+    append(1000);
+    CHECK(datalog_close() == FR_OK);
+    read_header(&newest, 1);
+    CHECK(newest.committed == written);
+    check_data(older.committed, written);
+}
+
+static void rejected_block(void) {
+    static struct datalog_header before, after;
+
+    read_header(&before, 1);
+    open_log();
+    disk_fail_block = 2;
+    append(DATALOG_BUF_SIZE * 2);
+    CHECK(datalog_close() == FR_DISK_ERR);
+    CHECK(!disk_fail_block);
+    read_header(&after, 1);
+    CHECK(after.sequence == before.sequence);
+
+    // the records that didn't make it are written again
+    open_log();
+    written = before.committed;
+    append(1000);
+    CHECK(datalog_close() == FR_OK);
+    read_header(&after, 1);
+    CHECK(after.committed == written);
+    check_data(before.committed, written);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        printf("usage: test_datalog image\n");
+        return 2;
+    }
+    disk_image = argv[1];
+    CHECK(pf_mount(&fs) == FR_OK);
+    if (!failures) {
+        persist();
+    }
+    if (!failures) {
+        torn_header();
+        rejected_block();
+        check_data(0, written);
+    }
+    CHECK(!disk_misuse);
+    printf("test_datalog %s: %u failed\n", argv[1], failures);
+    return failures != 0;
+}
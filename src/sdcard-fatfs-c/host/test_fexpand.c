@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "check.h"
+#include "disk.h"
+#include "pff.h"
+
+// pf_fexpand() on images the Makefile makes with tools/mkfatimg.py. LOG.BIN
+// is empty. on the fragmented image GAPS.BIN takes every other cluster of
+// most of the volume, so there is plenty of free space but only a short run
+// of it at the end.
+
+#define CLUSTER 512
+
+static FATFS fs;
+static FIL fil;
+
+static void expand(uint32_t clusters, FRESULT want) {
+    static DWORD sect, count;
+    FRESULT res;
+
+    CHECK(pf_fopen(&fil, "LOG.BIN") == FR_OK);
+    res = pf_fexpand(&fil, clusters * CLUSTER);
+    CHECK(res == want);
+    if (res != FR_OK) {
+        // the file is left as it was
+        CHECK(fil.fsize == 0);
+        CHECK(fil.org_clust == 0);
+        return;
+    }
+    CHECK(pf_fopen(&fil, "LOG.BIN") == FR_OK);
+    CHECK(fil.fsize == clusters * CLUSTER);
+    CHECK(pf_fextent(&fil, &sect, &count) == FR_OK);
+    CHECK(count == clusters * CLUSTER / 512);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("usage: test_fexpand image fragmented|empty\n");
+        return 2;
+    }
+    disk_image = argv[1];
+    CHECK(pf_mount(&fs) == FR_OK);
+    if (!failures) {
+        if (!strcmp(argv[2], "fragmented")) {
+            // about 4000 free clusters, fewer than a hundred of them in a row
+            expand(1000, FR_DENIED);
+            expand(5000, FR_DISK_FULL);
+            expand(50, FR_OK);
+        } else {
+            expand(200000, FR_DISK_FULL);
+            expand(2000, FR_OK);
+        }
+    }
+    printf("test_fexpand %s: %u failed\n", argv[1], failures);
+    return failures != 0;
+}
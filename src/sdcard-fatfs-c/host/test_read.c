@@ -0,0 +1,127 @@
+#include <stdlib.h>
+
+#include "check.h"
+#include "disk.h"
+#include "pff.h"
+
+// reads the files of the image the Makefile makes with tools/mkfatimg.py,
+// whole and incrementally, and lists the root directory
+
+struct file {
+    const char* path;
+    uint8_t seed;
+    uint32_t size;
+};
+
+// the --file arguments in the Makefile, in order
+static const struct file files[] = {
+    {"STREAM.BIN", 1, 70000},
+    {"FRAG.BIN", 2, 30000},
+    {"SUB/BACK.BIN", 3, 9000},
+    {"SMALL.BIN", 4, 100},
+};
+
+#define FILES (sizeof files / sizeof files[0])
+#define ROOT_ENTRIES 4      // STREAM.BIN, FRAG.BIN, SUB, SMALL.BIN
+
+static uint8_t expected(uint32_t ofs, uint8_t seed) {
+    return (uint8_t) (ofs ^ (ofs >> 8) ^ seed);
+}
+
+static uint32_t sink_ofs;
+static uint8_t sink_seed;
+static uint32_t sink_bad;
+
+static void check_sink(BYTE b) {
+    if (b != expected(sink_ofs++, sink_seed)) {
+        sink_bad++;
+    }
+}
+
+// pf_read() of a few bytes, then pf_read_start()/pf_read_step() a sector's
+// worth at a time, so most reads straddle a sector boundary
+static void read_steps(const struct file* f) {
+    static BYTE buffer[512];
+    UINT br, got, i;
+    uint32_t ofs, bad = 0;
+    FRESULT res;
+
+    CHECK(pf_open(f->path) == FR_OK);
+    CHECK(pf_read(buffer, 7, &br) == FR_OK);
+    for (ofs = 0; ofs != br; ofs++) {
+        bad += buffer[ofs] != expected(ofs, f->seed);
+    }
+    while (ofs < f->size) {
+        CHECK(pf_read_start(buffer, sizeof buffer) == FR_OK);
+        got = 0;
+        do {
+            res = pf_read_step(&br);
+            CHECK(br <= 512);
+            got += br;
+        } while (res == FR_IN_PROGRESS);
+        CHECK(res == FR_OK);
+        CHECK(got == (f->size - ofs < sizeof buffer ? f->size - ofs : sizeof buffer));
+        if (res != FR_OK || !got) {
+            break;
+        }
+        for (i = 0; i != got; i++, ofs++) {
+            bad += buffer[i] != expected(ofs, f->seed);
+        }
+    }
+    CHECK(ofs == f->size);
+    CHECK(!bad);
+}
+
+// the whole file forwarded to a sink with the FIL based variant
+static void forward_steps(const struct file* f) {
+    static FIL fil;
+    UINT br;
+    FRESULT res;
+
+    CHECK(pf_fopen(&fil, f->path) == FR_OK);
+    sink_ofs = 0;
+    sink_seed = f->seed;
+    sink_bad = 0;
+    disk_set_sink(check_sink);
+    CHECK(pf_fread_start(&fil, 0, 0xFFFF) == FR_OK);
+    do {
+        res = pf_fread_step(&fil, &br);
+    } while (res == FR_IN_PROGRESS);
+    disk_set_sink(0);
+    CHECK(res == FR_OK);
+    CHECK(sink_ofs == (f->size < 0xFFFF ? f->size : 0xFFFF));
+    CHECK(!sink_bad);
+}
+
+static void list_root(void) {
+    static DIR dir;
+    static FILINFO fno;
+    unsigned n = 0;
+
+    CHECK(pf_opendir(&dir, "") == FR_OK);
+    while (pf_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+        n++;
+    }
+    CHECK(n == ROOT_ENTRIES);
+}
+
+int main(int argc, char** argv) {
+    static FATFS fs;
+    unsigned i;
+
+    if (argc != 2) {
+        printf("usage: test_read image\n");
+        return 2;
+    }
+    disk_image = argv[1];
+    CHECK(pf_mount(&fs) == FR_OK);
+    if (!failures) {
+        for (i = 0; i != FILES; i++) {
+            read_steps(&files[i]);
+            forward_steps(&files[i]);
+        }
+        list_root();
+    }
+    printf("test_read %s: %u failed\n", argv[1], failures);
+    return failures != 0;
+}
@@ -0,0 +1,65 @@
+#include "check.h"
+#include "uart.h"
+
+#define UART_RR0_TX_EMPTY 0x04
+
+// reserve and commit chunks the way stream_task() and small_task() do, after
+// putbyte() has left the head off a chunk boundary. the transmitter is
+// always ready, so every reservation has to succeed after a pump.
+static void stream_unaligned(uint16_t chunk, uint8_t lead) {
+    __xdata uint8_t* base = 0;
+    __xdata uint8_t* p;
+    uint16_t i;
+    uint8_t tries;
+
+    uart.control_b = UART_RR0_TX_EMPTY;
+    for (i = 0; i != lead; i++) {
+        putbyte('x');
+    }
+    for (i = 0; i != 4 * UART_TX_SIZE / chunk; i++) {
+        tries = 0;
+        while (!(p = uart_tx_reserve(chunk)) && tries++ != 4) {
+            uart_pump();
+        }
+        CHECK(p);
+        if (!p) {
+            return;
+        }
+        if (!base || p < base) {
+            base = p;
+        }
+        CHECK(p - base + chunk <= UART_TX_SIZE);
+        uart_tx_commit(chunk);
+        uart_pump();
+    }
+}
+
+// with bytes still queued a reservation that doesn't fit before the end of
+// the buffer must wait, and get the front once the ring has drained
+static void wait_for_drain(void) {
+    __xdata uint8_t* front;
+    uint8_t i;
+
+    uart.control_b = UART_RR0_TX_EMPTY;
+    uart_flush();
+    front = uart_tx_reserve(1);
+    uart.control_b = 0;
+    putbyte('x');
+    for (i = 0; i != 7; i++) {
+        CHECK(uart_tx_reserve(128) == front + 1 + i * 128);
+        uart_tx_commit(128);
+    }
+    CHECK(!uart_tx_reserve(128));
+    uart.control_b = UART_RR0_TX_EMPTY;
+    uart_flush();
+    CHECK(uart_tx_reserve(128) == front);
+}
+
+int main(void) {
+    stream_unaligned(128, 5);
+    stream_unaligned(32, 7);
+    stream_unaligned(128, 127);
+    wait_for_drain();
+    printf("test_uart: %u failed\n", failures);
+    return failures != 0;
+}
@@ -37,6 +37,10 @@
 
 #include "pff.h"		/* Petit FatFs configurations and declarations */
 #include "diskio.h"		/* Declarations of low level disk I/O functions */
+#include "xmem.h"		/* XRAM block copy, fill and compare */
+#if PF_USE_CACHE
+#include "cache.h"		/* Sector cache */
+#endif
 
 
 
@@ -64,7 +68,45 @@
 #define _FS_32ONLY 0
 #endif
 
-#define ABORT(err)	{fs->flag = 0; return err;}
+#if PF_USE_INDEX
+#if !PF_USE_DIRBUF
+#error PF_USE_INDEX needs PF_USE_DIRBUF.
+#endif
+#if PF_INDEX_DIRS < 1 || PF_INDEX_DIRS > 8
+#error Wrong PF_INDEX_DIRS setting.
+#endif
+#endif
+
+#if PF_USE_GROW && !PF_USE_WRITE
+#error PF_USE_GROW needs PF_USE_WRITE.
+#endif
+
+#define ABORT(err)	{fp->flag = 0; return err;}
+
+/* Small, frequently used buffers. With PF_USE_PDATA they live in the pdata
+/  page and are reached with 8-bit movx @Ri. The linker puts the pdata page
+/  at the start of XRAM (page 0), so widening a pdata address to an xdata
+/  pointer for the shared helpers is just a zero high byte. The Makefile
+/  fails the link if the page is anywhere else, and pf_mount() loads P2 with
+/  it rather than relying on the startup code. */
+#if PF_USE_PDATA
+#define PF_HOT		__pdata
+#define HOT(p)		((__xdata BYTE*)(p))
+#else
+#define PF_HOT		__xdata
+#define HOT(p)		(p)
+#endif
+
+/* Sector reads tagged with what is being read, so the cache can pin FAT and
+/  directory sectors */
+#if PF_USE_CACHE
+#define disk_readk(buff, sect, ofs, cnt, kind)	cache_readp(buff, sect, ofs, cnt, kind)
+#else
+#define disk_readk(buff, sect, ofs, cnt, kind)	disk_readp(buff, sect, ofs, cnt)
+#define CACHE_DATA	0
+#define CACHE_FAT	1
+#define CACHE_DIR	2
+#endif
 
 
 
@@ -364,6 +406,11 @@
 #define	DIR_FstClusLO		26
 #define	DIR_FileSize		28
 
+#define FSI_LeadSig			0
+#define FSI_StrucSig		484
+#define FSI_Free_Count		488
+#define FSI_Nxt_Free		492
+
 
 
 
@@ -375,6 +422,45 @@
 
 
 static __xdata FATFS *FatFs;	/* Pointer to the file system object (logical drive) */
+static WORD Fsid;				/* File system mount ID */
+
+#if PF_USE_DIRBUF
+static __xdata BYTE DirBuf[512];	/* Directory sector buffer */
+static DWORD DirSect;				/* Sector held in DirBuf (0:None) */
+#endif
+
+#if PF_USE_PREFETCH
+static __xdata BYTE SectBuf[2][512];	/* File sector buffers */
+static DWORD SectTag[2];			/* Sector held in each buffer (0:None) */
+static BYTE SectLru;				/* Buffer to be replaced next */
+static __xdata FIL *PfFile;			/* File that has a sector to read ahead (0:None) */
+static CLUST PfClst, PfNext;		/* Cluster link followed by the read ahead */
+#endif
+
+#if PF_USE_WRITE && PF_USE_GROW
+static __xdata BYTE Win[512];	/* Sector window for FAT, FSInfo and directory updates */
+static DWORD WinSect;			/* Sector held in Win (0:None) */
+static BYTE WinDirty;			/* Win has been changed */
+#endif
+
+#if PF_USE_INDEX
+typedef struct {
+	BYTE	name[11];	/* SFN (name[0] == 0:Empty slot) */
+	BYTE	attr;		/* Attribute */
+	CLUST	dclust;		/* Start cluster of the directory holding the object (0:Root) */
+	CLUST	sclust;		/* Start cluster of the object */
+	DWORD	fsize;		/* Object size */
+	DWORD	sect;		/* Sector holding the directory entry */
+	WORD	index;		/* Index of the directory entry */
+} IDXENT;
+
+#define IDX_SLOTS	(PF_INDEX_SIZE / sizeof (IDXENT))
+
+static __xdata IDXENT Index[IDX_SLOTS];		/* Open addressed hash table of names */
+static __xdata CLUST IdxDir[PF_INDEX_DIRS];	/* Directories that have been indexed */
+static BYTE IdxDirs;						/* Number of directories in IdxDir */
+static BYTE IdxPartial;						/* Bit map of directories that didn't fit */
+#endif
 
 
 /*-----------------------------------------------------------------------*/
@@ -403,23 +489,33 @@ static DWORD ld_dword (const __xdata BYTE* ptr)	/* Load a 4-byte little-endian w
 
 
 
+static void st_word (__xdata BYTE* ptr, WORD val)	/* Store a 2-byte word in little-endian */
+{
+	ptr[0] = (BYTE)val; val >>= 8;
+	ptr[1] = (BYTE)val;
+}
+
+static void st_dword (__xdata BYTE* ptr, DWORD val)	/* Store a 4-byte word in little-endian */
+{
+	ptr[0] = (BYTE)val; val >>= 8;
+	ptr[1] = (BYTE)val; val >>= 8;
+	ptr[2] = (BYTE)val; val >>= 8;
+	ptr[3] = (BYTE)val;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* String functions                                                      */
 /*-----------------------------------------------------------------------*/
 
-/* Fill memory block */
-static void mem_set (void* dst, int val, int cnt) {
-	char *d = (char*)dst;
-	while (cnt--) *d++ = (char)val;
-}
+/* These only ever work on XRAM, so they map onto the xmem block functions,
+/  which walk one side with DPTR and the other with movx @R0 instead of
+/  reloading DPTR for every byte. */
 
-/* Compare memory block */
-static int mem_cmp (const void* dst, const void* src, int cnt) {
-	const char *d = (const char *)dst, *s = (const char *)src;
-	int r = 0;
-	while (cnt-- && (r = *d++ - *s++) == 0) ;
-	return r;
-}
+#define mem_set(dst, val, cnt)	xmem_fill(dst, val, cnt)	/* Fill memory block */
+#define mem_cpy(dst, src, cnt)	xmem_copy(dst, src, cnt)	/* Copy memory block */
+#define mem_cmp(dst, src, cnt)	xmem_cmp(dst, src, cnt)		/* Compare memory block (0:Equal) */
 
 
 
@@ -431,7 +527,7 @@ static CLUST get_fat (	/* 1:IO error, Else:Cluster status */
 	CLUST clst	/* Cluster# to get the link information */
 )
 {
-	__xdata BYTE buf[4];
+	PF_HOT BYTE buf[4];
 	__xdata FATFS *fs = FatFs;
 #if PF_FS_FAT12
 	UINT wc, bc, ofs;
@@ -445,24 +541,24 @@ static CLUST get_fat (	/* 1:IO error, Else:Cluster status */
 		bc = (UINT)clst; bc += bc / 2;
 		ofs = bc % 512; bc /= 512;
 		if (ofs != 511) {
-			if (disk_readp(buf, fs->fatbase + bc, ofs, 2)) break;
+			if (disk_readk(HOT(buf), fs->fatbase + bc, ofs, 2, CACHE_FAT)) break;
 		} else {
-			if (disk_readp(buf, fs->fatbase + bc, 511, 1)) break;
-			if (disk_readp(buf+1, fs->fatbase + bc + 1, 0, 1)) break;
+			if (disk_readk(HOT(buf), fs->fatbase + bc, 511, 1, CACHE_FAT)) break;
+			if (disk_readk(HOT(buf)+1, fs->fatbase + bc + 1, 0, 1, CACHE_FAT)) break;
 		}
-		wc = ld_word(buf);
+		wc = buf[0] | (WORD)buf[1] << 8;
 		return (clst & 1) ? (wc >> 4) : (wc & 0xFFF);
 	}
 #endif
 #if PF_FS_FAT16
 	case FS_FAT16 :
-		if (disk_readp(buf, fs->fatbase + clst / 256, ((UINT)clst % 256) * 2, 2)) break;
-		return ld_word(buf);
+		if (disk_readk(HOT(buf), fs->fatbase + clst / 256, ((UINT)clst % 256) * 2, 2, CACHE_FAT)) break;
+		return buf[0] | (WORD)buf[1] << 8;
 #endif
 #if PF_FS_FAT32
 	case FS_FAT32 :
-		if (disk_readp(buf, fs->fatbase + clst / 128, ((UINT)clst % 128) * 4, 4)) break;
-		return ld_dword(buf) & 0x0FFFFFFF;
+		if (disk_readk(HOT(buf), fs->fatbase + clst / 128, ((UINT)clst % 128) * 4, 4, CACHE_FAT)) break;
+		return ((DWORD)(buf[3] & 0x0F) << 24 | (DWORD)buf[2] << 16 | (WORD)buf[1] << 8 | buf[0]);
 #endif
 	}
 
@@ -472,6 +568,43 @@ static CLUST get_fat (	/* 1:IO error, Else:Cluster status */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Sector buffers for small reads and read ahead                         */
+/*-----------------------------------------------------------------------*/
+#if PF_USE_PREFETCH
+
+static __xdata BYTE* sect_load (	/* Pointer to the buffered sector, 0:Disk error */
+	DWORD sect				/* Sector number */
+)
+{
+	BYTE i;
+
+
+	if (SectTag[0] == sect) { SectLru = 1; return SectBuf[0]; }	/* Already buffered? */
+	if (SectTag[1] == sect) { SectLru = 0; return SectBuf[1]; }
+
+	i = SectLru;							/* Replace the older buffer */
+	SectTag[i] = 0;
+	if (disk_readk(SectBuf[i], sect, 0, 512, CACHE_DATA)) return 0;
+	SectTag[i] = sect;
+	SectLru = i ^ 1;
+
+	return SectBuf[i];
+}
+
+
+static void sect_drop (
+	DWORD sect				/* Sector number that is being overwritten */
+)
+{
+	if (SectTag[0] == sect) SectTag[0] = 0;
+	if (SectTag[1] == sect) SectTag[1] = 0;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Get sector# from cluster# / Get cluster field from directory entry    */
 /*-----------------------------------------------------------------------*/
@@ -507,6 +640,247 @@ static CLUST get_clust (
 }
 
 
+/*-----------------------------------------------------------------------*/
+/* Sector window for FAT, FSInfo and directory updates                   */
+/*-----------------------------------------------------------------------*/
+#if PF_USE_WRITE && PF_USE_GROW
+
+static FRESULT write_sect (	/* Write Win to a sector */
+	DWORD sect				/* Sector number */
+)
+{
+	if (disk_writep(0, sect) || disk_writep(Win, 512) || disk_writep(0, 0)) return FR_DISK_ERR;
+#if PF_USE_CACHE
+	cache_invalidate(sect);		/* Drop copies that are going stale */
+#endif
+#if PF_USE_PREFETCH
+	sect_drop(sect);
+#endif
+#if PF_USE_DIRBUF
+	if (DirSect == sect) DirSect = 0;
+#endif
+
+	return FR_OK;
+}
+
+
+static FRESULT sync_window (void)	/* Write back Win if changed, to every FAT copy for FAT sectors */
+{
+	DWORD sect = WinSect;
+	BYTE n = 1;
+	__xdata FATFS *fs = FatFs;
+
+
+	if (WinDirty) {
+		if (sect >= fs->fatbase && sect < fs->fatbase + fs->fsize) n = fs->n_fats;
+		for ( ; n; n--, sect += fs->fsize) {
+			if (write_sect(sect)) return FR_DISK_ERR;
+		}
+		WinDirty = 0;
+	}
+
+	return FR_OK;
+}
+
+
+static FRESULT move_window (	/* Load a sector into Win */
+	DWORD sect,				/* Sector number */
+	BYTE kind				/* What the sector holds, for the cache */
+)
+{
+	if (sect != WinSect) {
+		if (sync_window()) return FR_DISK_ERR;
+		WinSect = 0;
+		if (disk_readk(Win, sect, 0, 512, kind)) return FR_DISK_ERR;
+		WinSect = sect;
+	}
+
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT access - Read and change FAT entries through the window           */
+/*-----------------------------------------------------------------------*/
+/* Only FAT16 and FAT32 volumes can be grown. Reads go through Win rather
+/  than get_fat() so they see entries changed but not yet written back. */
+
+static CLUST get_ent (	/* 1:IO error, Else:Cluster status */
+	CLUST clst			/* Cluster# to get the link information */
+)
+{
+	__xdata FATFS *fs = FatFs;
+
+
+	switch (fs->fs_type) {
+#if PF_FS_FAT16
+	case FS_FAT16 :
+		if (move_window(fs->fatbase + clst / 256, CACHE_FAT)) break;
+		return ld_word(Win + (UINT)clst % 256 * 2);
+#endif
+#if PF_FS_FAT32
+	case FS_FAT32 :
+		if (move_window(fs->fatbase + clst / 128, CACHE_FAT)) break;
+		return ld_dword(Win + (UINT)clst % 128 * 4) & 0x0FFFFFFF;
+#endif
+	}
+
+	return 1;
+}
+
+
+static FRESULT put_fat (
+	CLUST clst,			/* Cluster# to be changed */
+	CLUST val			/* New value of the entry */
+)
+{
+	__xdata FATFS *fs = FatFs;
+
+
+	switch (fs->fs_type) {
+#if PF_FS_FAT16
+	case FS_FAT16 :
+		if (move_window(fs->fatbase + clst / 256, CACHE_FAT)) return FR_DISK_ERR;
+		st_word(Win + (UINT)clst % 256 * 2, (WORD)val);
+		break;
+#endif
+#if PF_FS_FAT32
+	case FS_FAT32 : {
+		__xdata BYTE *p;
+
+		if (move_window(fs->fatbase + clst / 128, CACHE_FAT)) return FR_DISK_ERR;
+		p = Win + (UINT)clst % 128 * 4;
+		st_dword(p, (ld_dword(p) & 0xF0000000) | ((DWORD)val & 0x0FFFFFFF));	/* Keep the reserved bits */
+		break;
+	}
+#endif
+	default :
+		return FR_NOT_ENABLED;
+	}
+	WinDirty = 1;
+#if PF_USE_PREFETCH
+	if (PfClst == clst) PfClst = 0;		/* Forget the link remembered by the read ahead */
+#endif
+
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Cluster allocation - Find and chain a run of free clusters            */
+/*-----------------------------------------------------------------------*/
+
+static CLUST find_run (	/* First cluster of the run, 0:No run (free_clust updated), 1:IO error */
+	CLUST scl,			/* Search starts after this cluster */
+	CLUST n				/* Number of contiguous free clusters needed */
+)
+{
+	CLUST clst, len, val, nfree;
+	DWORD cnt;
+	__xdata FATFS *fs = FatFs;
+
+
+	clst = scl; len = 0; nfree = 0;
+	cnt = fs->n_fatent - 2 + n;			/* Once round the FAT, plus a run that straddles the start */
+	while (cnt--) {
+		if (++clst >= fs->n_fatent) {	/* Wrap around, runs can't */
+			clst = 2; len = 0;
+		}
+		val = get_ent(clst);
+		if (val == 1) return 1;
+		if (val) {
+			len = 0;
+		} else {
+			if (++len == n) return clst - n + 1;
+			if (cnt >= n) nfree++;		/* Count each cluster once, not the straddling part */
+		}
+	}
+	fs->free_clust = nfree;				/* The whole FAT was scanned, so the count is exact */
+
+	return 0;
+}
+
+
+static FRESULT grow_chain (
+	__xdata FIL *fp,	/* File to be extended */
+	CLUST last,			/* Last cluster of the file (0:File is empty) */
+	CLUST n				/* Number of clusters to add */
+)
+{
+	CLUST scl, clst;
+	__xdata FATFS *fs = FatFs;
+
+
+	if (PF_FS_FAT12 && fs->fs_type == FS_FAT12) return FR_NOT_ENABLED;	/* FAT12 can't be grown */
+	scl = find_run(last ? last : fs->last_clust, n);	/* Try to follow on from the file */
+	if (scl == 1) return FR_DISK_ERR;
+	if (!scl) return fs->free_clust >= n ? FR_DENIED : FR_DISK_FULL;	/* Fragmented or full */
+
+	for (clst = scl; clst != scl + n - 1; clst++) {	/* Chain the run, then link it to the file */
+		if (put_fat(clst, clst + 1)) return FR_DISK_ERR;
+	}
+	if (put_fat(clst, (CLUST)0x0FFFFFFF)) return FR_DISK_ERR;	/* End of chain */
+	if (last) {
+		if (put_fat(last, scl)) return FR_DISK_ERR;
+	} else {
+		fp->org_clust = scl;
+		fp->flag |= FA__DIRTY;
+	}
+
+	fs->last_clust = clst;
+	if (fs->free_clust <= fs->n_fatent - 2) fs->free_clust -= n;
+	fs->fsi_flag = 1;
+
+	return sync_window();
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write back the directory entry and FSInfo                             */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT sync_file (
+	__xdata FIL *fp		/* File whose size or start cluster has changed */
+)
+{
+	__xdata BYTE *dir;
+	__xdata FATFS *fs = FatFs;
+
+
+	if (fp->flag & FA__DIRTY) {
+		if (move_window(fp->dir_sect, CACHE_DIR)) return FR_DISK_ERR;
+		dir = Win + fp->dir_ofs;
+		st_dword(dir+DIR_FileSize, fp->fsize);
+		st_word(dir+DIR_FstClusLO, (WORD)fp->org_clust);
+		st_word(dir+DIR_FstClusHI, (WORD)((DWORD)fp->org_clust >> 16));
+		dir[DIR_Attr] |= AM_ARC;
+		WinDirty = 1;
+		fp->flag &= ~FA__DIRTY;
+#if PF_USE_INDEX
+		IdxDirs = 0;			/* Indexed size and cluster are stale */
+#endif
+	}
+	if (fs->fsi_flag && fs->fsi_sect) {
+		if (move_window(fs->fsi_sect, CACHE_DATA)) return FR_DISK_ERR;
+		st_dword(Win+FSI_Free_Count, fs->free_clust);
+		st_dword(Win+FSI_Nxt_Free, fs->last_clust);
+		WinDirty = 1;
+		fs->fsi_flag = 0;
+	}
+
+	return sync_window();
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Rewind directory index                           */
 /*-----------------------------------------------------------------------*/
@@ -581,6 +955,21 @@ static FRESULT dir_next (	/* FR_OK:Succeeded, FR_NO_FILE:End of table */
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
 
+#if PF_USE_DIRBUF
+static __xdata BYTE* dir_entry (	/* Pointer to the current entry in DirBuf, 0:Disk error */
+	__xdata DIR *dj			/* Pointer to the directory object */
+)
+{
+	if (dj->sect != DirSect) {		/* Load the sector holding the entry on the first access */
+		DirSect = 0;
+		if (disk_readk(DirBuf, dj->sect, 0, 512, CACHE_DIR)) return 0;
+		DirSect = dj->sect;
+	}
+	return &DirBuf[(dj->index % 16) * 32];
+}
+#endif
+
+
 static FRESULT dir_find (
 	__xdata DIR *dj,		/* Pointer to the directory object linked to the file name */
 	__xdata BYTE *dir		/* 32-byte working buffer */
@@ -588,18 +977,32 @@ static FRESULT dir_find (
 {
 	FRESULT res;
 	BYTE c;
+#if PF_USE_DIRBUF
+	__xdata BYTE *ent;
+#endif
 
 
 	res = dir_rewind(dj);			/* Rewind directory object */
 	if (res != FR_OK) return res;
 
 	do {
-		res = disk_readp(dir, dj->sect, (dj->index % 16) * 32, 32)	/* Read an entry */
+#if PF_USE_DIRBUF
+		ent = dir_entry(dj);			/* Point to an entry in the buffered sector */
+		if (!ent) { res = FR_DISK_ERR; break; }
+		c = ent[DIR_Name];	/* First character */
+		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+		if (!(ent[DIR_Attr] & AM_VOL) && !mem_cmp(ent, dj->fn, 11)) {	/* Is it a valid entry? */
+			mem_cpy(dir, ent, 32);
+			break;
+		}
+#else
+		res = disk_readk(dir, dj->sect, (dj->index % 16) * 32, 32, CACHE_DIR)	/* Read an entry */
 			? FR_DISK_ERR : FR_OK;
 		if (res != FR_OK) break;
 		c = dir[DIR_Name];	/* First character */
 		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
 		if (!(dir[DIR_Attr] & AM_VOL) && !mem_cmp(dir, dj->fn, 11)) break;	/* Is it a valid entry? */
+#endif
 		res = dir_next(dj);					/* Next entry */
 	} while (res == FR_OK);
 
@@ -609,6 +1012,133 @@ static FRESULT dir_find (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Directory name index                                                  */
+/*-----------------------------------------------------------------------*/
+/* Each directory is scanned once on its first lookup and every entry is
+/  hashed into Index, keyed by the directory's start cluster and the SFN.
+/  Later lookups in that directory are answered from XRAM. A directory that
+/  doesn't fit in the budget keeps what was added and falls back to a scan
+/  on a miss. */
+#if PF_USE_INDEX
+
+static UINT idx_hash (	/* Home slot of the name */
+	CLUST dclust,			/* Directory start cluster */
+	const __xdata BYTE* name	/* SFN */
+)
+{
+	UINT h = (UINT)dclust;
+	BYTE i;
+
+
+	for (i = 0; i < 11; i++) h = (h << 5) - h + name[i];	/* h * 31 + c */
+	return h % IDX_SLOTS;
+}
+
+
+static __xdata IDXENT* idx_lookup (	/* Matching slot, empty slot if insert, 0:Not found / table full */
+	CLUST dclust,			/* Directory start cluster */
+	const __xdata BYTE* name,	/* SFN */
+	BYTE insert				/* Return an empty slot if the name isn't there */
+)
+{
+	UINT i, n;
+	__xdata IDXENT *e;
+
+
+	i = idx_hash(dclust, name);
+	for (n = 0; n < IDX_SLOTS; n++) {
+		e = &Index[i];
+		if (!e->name[0]) return insert ? e : 0;	/* End of the probe sequence */
+		if (e->dclust == dclust && !mem_cmp(e->name, name, 11)) return e;
+		if (++i == IDX_SLOTS) i = 0;
+	}
+
+	return 0;
+}
+
+
+static FRESULT idx_build (
+	__xdata DIR *dj			/* Directory object to index */
+)
+{
+	FRESULT res;
+	BYTE c, bit;
+	__xdata BYTE *ent;
+	__xdata IDXENT *e;
+
+
+	bit = 1 << IdxDirs;
+	IdxDir[IdxDirs++] = dj->sclust;		/* Register the directory */
+	IdxPartial &= ~bit;
+
+	res = dir_rewind(dj);
+	while (res == FR_OK) {
+		ent = dir_entry(dj);
+		if (!ent) { res = FR_DISK_ERR; break; }
+		c = ent[DIR_Name];
+		if (c == 0) break;					/* Reached to end of table */
+		if (c != 0xE5 && !(ent[DIR_Attr] & AM_VOL)) {
+			e = idx_lookup(dj->sclust, ent, 1);
+			if (!e) {						/* Table is full */
+				IdxPartial |= bit;
+				break;
+			}
+			mem_cpy(e->name, ent, 11);
+			e->attr = ent[DIR_Attr];
+			e->dclust = dj->sclust;
+			e->sclust = get_clust(ent);
+			e->fsize = ld_dword(ent+DIR_FileSize);
+			e->sect = dj->sect;
+			e->index = dj->index;
+		}
+		res = dir_next(dj);
+	}
+	if (res == FR_NO_FILE) res = FR_OK;
+	if (res != FR_OK) IdxDirs--;		/* Entries already added are still valid */
+
+	return res;
+}
+
+
+static FRESULT idx_find (
+	__xdata DIR *dj,		/* Pointer to the directory object linked to the file name */
+	__xdata BYTE *dir		/* 32-byte working buffer */
+)
+{
+	FRESULT res;
+	BYTE i;
+	__xdata IDXENT *e;
+
+
+	for (i = 0; i < IdxDirs && IdxDir[i] != dj->sclust; i++) ;
+	if (i == IdxDirs) {					/* Directory not indexed yet */
+		if (IdxDirs == PF_INDEX_DIRS) return dir_find(dj, dir);	/* No room, scan it */
+		res = idx_build(dj);
+		if (res != FR_OK) return res;
+	}
+
+	e = idx_lookup(dj->sclust, dj->fn, 0);
+	if (!e) {
+		return (IdxPartial & (1 << i)) ? dir_find(dj, dir) : FR_NO_FILE;
+	}
+
+	mem_set(dir, 0, 32);				/* Rebuild the directory entry */
+	mem_cpy(dir, e->name, 11);
+	dir[DIR_Attr] = e->attr;
+	st_word(dir+DIR_FstClusHI, (WORD)((DWORD)e->sclust >> 16));
+	st_word(dir+DIR_FstClusLO, (WORD)e->sclust);
+	st_dword(dir+DIR_FileSize, e->fsize);
+	dj->sect = e->sect;
+	dj->index = e->index;
+
+	return FR_OK;
+}
+#endif /* PF_USE_INDEX */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Read an object from the directory                                     */
 /*-----------------------------------------------------------------------*/
@@ -620,17 +1150,33 @@ static FRESULT dir_read (
 {
 	FRESULT res;
 	BYTE a, c;
+#if PF_USE_DIRBUF
+	__xdata BYTE *ent;
+#endif
 
 
 	res = FR_NO_FILE;
 	while (dj->sect) {
-		res = disk_readp(dir, dj->sect, (dj->index % 16) * 32, 32)	/* Read an entry */
+#if PF_USE_DIRBUF
+		ent = dir_entry(dj);			/* Point to an entry in the buffered sector */
+		if (!ent) { res = FR_DISK_ERR; break; }
+		c = ent[DIR_Name];
+		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+		a = ent[DIR_Attr] & AM_MASK;
+		if (c != 0xE5 && c != '.' && !(a & AM_VOL)) {	/* Is it a valid entry? */
+			mem_cpy(dir, ent, 32);
+			res = FR_OK;
+			break;
+		}
+#else
+		res = disk_readk(dir, dj->sect, (dj->index % 16) * 32, 32, CACHE_DIR)	/* Read an entry */
 			? FR_DISK_ERR : FR_OK;
 		if (res != FR_OK) break;
 		c = dir[DIR_Name];
 		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
 		a = dir[DIR_Attr] & AM_MASK;
 		if (c != 0xE5 && c != '.' && !(a & AM_VOL))	break;	/* Is it a valid entry? */
+#endif
 		res = dir_next(dj);			/* Next entry */
 		if (res != FR_OK) break;
 	}
@@ -648,9 +1194,9 @@ static FRESULT dir_read (
 /*-----------------------------------------------------------------------*/
 
 
-static FRESULT create_name (
+static const __code char* create_name (	/* Pointer to the next segment */
 	__xdata DIR *dj,			/* Pointer to the directory object */
-	const __code char **path	/* Pointer to pointer to the segment in the path string */
+	const __code char *path		/* Pointer to the segment in the path string */
 )
 {
 	BYTE c, d, ni, si, i;
@@ -664,7 +1210,7 @@ static FRESULT create_name (
 	sfn = dj->fn;
 	mem_set(sfn, ' ', 11);
 	si = i = 0; ni = 8;
-	p = *path;
+	p = path;
 	for (;;) {
 		c = p[si++];
 		if (c <= ' ' || c == '/') break;	/* Break on end of segment */
@@ -685,11 +1231,9 @@ static FRESULT create_name (
 			sfn[i++] = c;
 		}
 	}
-	*path = &p[si];						/* Rerurn pointer to the next segment */
-
 	sfn[11] = (c <= ' ') ? 1 : 0;		/* Set last segment flag if end of path */
 
-	return FR_OK;
+	return &p[si];						/* Return pointer to the next segment */
 }
 
 
@@ -759,9 +1303,12 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 
 	} else {							/* Follow path */
 		for (;;) {
-			res = create_name(dj, &path);	/* Get a segment */
-			if (res != FR_OK) break;
+			path = create_name(dj, path);	/* Get a segment */
+#if PF_USE_INDEX
+			res = idx_find(dj, dir);		/* Find it */
+#else
 			res = dir_find(dj, dir);		/* Find it */
+#endif
 			if (res != FR_OK) break;		/* Could not find the object */
 			if (dj->fn[11]) break;			/* Last segment match. Function completed. */
 			if (!(dir[DIR_Attr] & AM_DIR)) { /* Cannot follow path because it is a file */
@@ -786,17 +1333,17 @@ static BYTE check_fs (	/* 0:The FAT boot record, 1:Valid boot record but not an
 	DWORD sect			/* Sector# (lba) to check if it is an FAT boot record or not */
 )
 {
-	if (disk_readp(buf, sect, 510, 2)) {	/* Read the boot record */
+	if (disk_readk(buf, sect, 510, 2, CACHE_DATA)) {	/* Read the boot record */
 		return 3;
 	}
 	if (ld_word(buf) != 0xAA55) {			/* Check record signature */
 		return 2;
 	}
 
-	if (!_FS_32ONLY && !disk_readp(buf, sect, BS_FilSysType, 2) && ld_word(buf) == 0x4146) {	/* Check FAT12/16 */
+	if (!_FS_32ONLY && !disk_readk(buf, sect, BS_FilSysType, 2, CACHE_DATA) && ld_word(buf) == 0x4146) {	/* Check FAT12/16 */
 		return 0;
 	}
-	if (PF_FS_FAT32 && !disk_readp(buf, sect, BS_FilSysType32, 2) && ld_word(buf) == 0x4146) {	/* Check FAT32 */
+	if (PF_FS_FAT32 && !disk_readk(buf, sect, BS_FilSysType32, 2, CACHE_DATA) && ld_word(buf) == 0x4146) {	/* Check FAT32 */
 		return 0;
 	}
 	return 1;
@@ -819,14 +1366,34 @@ static BYTE check_fs (	/* 0:The FAT boot record, 1:Valid boot record but not an
 
 FRESULT pf_mount (
 	__xdata FATFS* fs		/* Pointer to new file system object */
-) __reentrant
+) PF_REENTRANT
 {
 	BYTE fmt;
-	__xdata static BYTE buf[36];
+	PF_HOT static BYTE buf[38];
 	__xdata static DWORD bsect, fsize, tsect, mclst;
 
 
 	FatFs = 0;
+#if PF_USE_PDATA
+	P2 = 0;								/* movx @Ri reaches the pdata page */
+#endif
+#if PF_USE_CACHE
+	cache_reset();						/* The card may have been changed */
+#endif
+#if PF_USE_DIRBUF
+	DirSect = 0;						/* Invalidate directory buffer */
+#endif
+#if PF_USE_PREFETCH
+	SectTag[0] = SectTag[1] = 0;		/* Invalidate sector buffers */
+	PfFile = 0; PfClst = 0;
+#endif
+#if PF_USE_INDEX
+	IdxDirs = 0;						/* Invalidate name index */
+	mem_set((__xdata BYTE*)Index, 0, sizeof Index);
+#endif
+#if PF_USE_WRITE && PF_USE_GROW
+	WinSect = 0; WinDirty = 0;			/* Invalidate window */
+#endif
 
 	if (disk_initialize() & STA_NOINIT) {	/* Check if the drive is ready or not */
 		return FR_NOT_READY;
@@ -834,15 +1401,15 @@ FRESULT pf_mount (
 
 	/* Search FAT partition on the drive */
 	bsect = 0;
-	fmt = check_fs(buf, bsect);			/* Check sector 0 as an SFD format */
+	fmt = check_fs(HOT(buf), bsect);			/* Check sector 0 as an SFD format */
 	if (fmt == 1) {						/* Not an FAT boot record, it may be FDISK format */
 		/* Check a partition listed in top of the partition table */
-		if (disk_readp(buf, bsect, MBR_Table, 16)) {	/* 1st partition entry */
+		if (disk_readk(HOT(buf), bsect, MBR_Table, 16, CACHE_DATA)) {	/* 1st partition entry */
 			fmt = 3;
 		} else {
 			if (buf[4]) {					/* Is the partition existing? */
-				bsect = ld_dword(&buf[8]);	/* Partition offset in LBA */
-				fmt = check_fs(buf, bsect);	/* Check the partition */
+				bsect = ld_dword(HOT(buf)+8);	/* Partition offset in LBA */
+				fmt = check_fs(HOT(buf), bsect);	/* Check the partition */
 			}
 		}
 	}
@@ -850,19 +1417,23 @@ FRESULT pf_mount (
 	if (fmt) return FR_NO_FILESYSTEM;	/* No valid FAT patition is found */
 
 	/* Initialize the file system object */
-	if (disk_readp(buf, bsect, 13, sizeof (buf))) return FR_DISK_ERR;
+	if (disk_readk(HOT(buf), bsect, 13, sizeof (buf), CACHE_DATA)) return FR_DISK_ERR;
 
-	fsize = ld_word(buf+BPB_FATSz16-13);				/* Number of sectors per FAT */
-	if (!fsize) fsize = ld_dword(buf+BPB_FATSz32-13);
+	fsize = ld_word(HOT(buf)+BPB_FATSz16-13);				/* Number of sectors per FAT */
+	if (!fsize) fsize = ld_dword(HOT(buf)+BPB_FATSz32-13);
 
+#if PF_USE_WRITE && PF_USE_GROW
+	fs->fsize = fsize;
+	fs->n_fats = buf[BPB_NumFATs-13];
+#endif
 	fsize *= buf[BPB_NumFATs-13];						/* Number of sectors in FAT area */
-	fs->fatbase = bsect + ld_word(buf+BPB_RsvdSecCnt-13); /* FAT start sector (lba) */
+	fs->fatbase = bsect + ld_word(HOT(buf)+BPB_RsvdSecCnt-13); /* FAT start sector (lba) */
 	fs->csize = buf[BPB_SecPerClus-13];					/* Number of sectors per cluster */
-	fs->n_rootdir = ld_word(buf+BPB_RootEntCnt-13);		/* Nmuber of root directory entries */
-	tsect = ld_word(buf+BPB_TotSec16-13);				/* Number of sectors on the file system */
-	if (!tsect) tsect = ld_dword(buf+BPB_TotSec32-13);
+	fs->n_rootdir = ld_word(HOT(buf)+BPB_RootEntCnt-13);		/* Nmuber of root directory entries */
+	tsect = ld_word(HOT(buf)+BPB_TotSec16-13);				/* Number of sectors on the file system */
+	if (!tsect) tsect = ld_dword(HOT(buf)+BPB_TotSec32-13);
 	mclst = (tsect						/* Last cluster# + 1 */
-		- ld_word(buf+BPB_RsvdSecCnt-13) - fsize - fs->n_rootdir / 16
+		- ld_word(HOT(buf)+BPB_RsvdSecCnt-13) - fsize - fs->n_rootdir / 16
 		) / fs->csize + 2;
 	fs->n_fatent = (CLUST)mclst;
 
@@ -874,13 +1445,31 @@ FRESULT pf_mount (
 	fs->fs_type = fmt;
 
 	if (_FS_32ONLY || (PF_FS_FAT32 && fmt == FS_FAT32)) {
-		fs->dirbase = ld_dword(buf+(BPB_RootClus-13));	/* Root directory start cluster */
+		fs->dirbase = ld_dword(HOT(buf)+(BPB_RootClus-13));	/* Root directory start cluster */
 	} else {
 		fs->dirbase = fs->fatbase + fsize;				/* Root directory start sector (lba) */
 	}
 	fs->database = fs->fatbase + fsize + fs->n_rootdir / 16;	/* Data start sector (lba) */
 
-	fs->flag = 0;
+#if PF_USE_WRITE && PF_USE_GROW
+	fs->fsi_sect = 0;					/* No FSInfo: search from the top, free count unknown */
+	fs->fsi_flag = 0;
+	fs->last_clust = 1;
+	fs->free_clust = (CLUST)0xFFFFFFFF;
+	if (PF_FS_FAT32 && fmt == FS_FAT32) {
+		bsect += ld_word(HOT(buf)+BPB_FSInfo-13);	/* Load the free cluster hints from FSInfo */
+		if (!disk_readk(HOT(buf), bsect, FSI_LeadSig, 4, CACHE_DATA) && ld_dword(HOT(buf)) == 0x41615252
+			&& !disk_readk(HOT(buf), bsect, FSI_StrucSig, 12, CACHE_DATA) && ld_dword(HOT(buf)) == 0x61417272) {
+			fs->fsi_sect = bsect;
+			fs->free_clust = ld_dword(HOT(buf)+4);
+			mclst = ld_dword(HOT(buf)+8);
+			if (mclst >= 2 && mclst < fs->n_fatent) fs->last_clust = mclst;
+		}
+	}
+#endif
+
+	fs->id = ++Fsid;					/* File system mount ID (invalidates open files) */
+	fs->file.flag = 0;
 	FatFs = fs;
 
 	return FR_OK;
@@ -889,38 +1478,77 @@ FRESULT pf_mount (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Check if the file object is valid                                     */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT validate (	/* FR_OK(0): The file object is valid, !=0: error code */
+	__xdata FIL *fp			/* Pointer to the file object */
+)
+{
+	__xdata FATFS *fs = FatFs;
+
+
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+	if (!(fp->flag & FA_OPENED) || fp->id != fs->id) return FR_NOT_OPENED;	/* Check if opened on this mount */
+
+	return FR_OK;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Open or Create a File                                                 */
 /*-----------------------------------------------------------------------*/
 
-FRESULT pf_open (
+FRESULT pf_fopen (
+	__xdata FIL *fp,		/* Pointer to the blank file object */
 	const __code char *path	/* Pointer to the file name */
-) __reentrant
+) PF_REENTRANT
 {
 	FRESULT res;
 	__xdata static DIR dj;
-	__xdata static BYTE sp[12];
-	__xdata static BYTE dir[32];
+	PF_HOT static BYTE sp[12];
+	PF_HOT static BYTE dir[32];
 	__xdata FATFS *fs = FatFs;
 
 
 	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
 
-	fs->flag = 0;
-	dj.fn = sp;
-	res = follow_path(&dj, dir, path);	/* Follow the file path */
+	fp->flag = 0;
+	dj.fn = HOT(sp);
+	res = follow_path(&dj, HOT(dir), path);	/* Follow the file path */
 	if (res != FR_OK) return res;		/* Follow failed */
 	if (!dir[0] || (dir[DIR_Attr] & AM_DIR)) return FR_NO_FILE;	/* It is a directory */
 
-	fs->org_clust = get_clust(dir);		/* File start cluster */
-	fs->fsize = ld_dword(dir+DIR_FileSize);	/* File size */
-	fs->fptr = 0;						/* File pointer */
-	fs->flag = FA_OPENED;
+	fp->org_clust = get_clust(HOT(dir));		/* File start cluster */
+	fp->fsize = ld_dword(HOT(dir)+DIR_FileSize);	/* File size */
+	fp->fptr = 0;						/* File pointer */
+#if PF_USE_WRITE && PF_USE_GROW
+	fp->dir_sect = dj.sect;				/* Where to write back size and start cluster */
+	fp->dir_ofs = (dj.index % 16) * 32;
+#endif
+	fp->id = fs->id;
+	fp->flag = FA_OPENED;
 
 	return FR_OK;
 }
 
 
+FRESULT pf_open (
+	const __code char *path	/* Pointer to the file name */
+) PF_REENTRANT
+{
+	__xdata FATFS *fs = FatFs;
+
+
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+
+	return pf_fopen(&fs->file, path);
+}
+
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -928,55 +1556,233 @@ FRESULT pf_open (
 /*-----------------------------------------------------------------------*/
 #if PF_USE_READ
 
-FRESULT pf_read (
+static UINT read_part (	/* 0:Disk error, Else:Number of bytes read */
+	__xdata FIL *fp,		/* Pointer to the file object */
+	__xdata BYTE* buff,		/* Pointer to the read buffer (NULL:Forward data to the stream) */
+	UINT btr				/* Number of bytes to read (non-zero, within the file) */
+)
+{
+	CLUST clst;
+	DWORD sect;
+	UINT rcnt;
+	BYTE cs;
+#if PF_USE_PREFETCH
+	__xdata BYTE *sbuf;
+#endif
+	__xdata FATFS *fs = FatFs;
+
+
+	if ((fp->fptr % 512) == 0) {				/* On the sector boundary? */
+		cs = (BYTE)(fp->fptr / 512 & (fs->csize - 1));	/* Sector offset in the cluster */
+		if (!cs) {								/* On the cluster boundary? */
+			if (fp->fptr == 0) {				/* On the top of the file? */
+				clst = fp->org_clust;
+#if PF_USE_PREFETCH
+			} else if (fp->curr_clust == PfClst) {	/* Link already followed by the read ahead */
+				clst = PfNext;
+#endif
+			} else {
+				clst = get_fat(fp->curr_clust);
+			}
+			if (clst <= 1) return 0;
+			fp->curr_clust = clst;				/* Update current cluster */
+		}
+		sect = clust2sect(fp->curr_clust);		/* Get current sector */
+		if (!sect) return 0;
+		fp->dsect = sect + cs;
+	}
+	rcnt = 512 - (UINT)fp->fptr % 512;			/* Get partial sector data from sector buffer */
+	if (rcnt > btr) rcnt = btr;
+#if PF_USE_PREFETCH
+	if (buff && (rcnt < 512 || SectTag[0] == fp->dsect || SectTag[1] == fp->dsect)) {
+		sbuf = sect_load(fp->dsect);			/* Partial or read ahead sector, copy from the buffer */
+		if (!sbuf) return 0;
+		mem_cpy(buff, sbuf + (UINT)fp->fptr % 512, rcnt);
+	} else
+#endif
+	if (disk_readk(buff, fp->dsect, (UINT)fp->fptr % 512, rcnt, CACHE_DATA)) return 0;
+	fp->fptr += rcnt;							/* Advances file read pointer */
+#if PF_USE_PREFETCH
+	if ((fp->fptr % 512) == 0 && fp->fptr < fp->fsize) PfFile = fp;	/* Next sector can be read ahead */
+#endif
+
+	return rcnt;
+}
+
+
+FRESULT pf_fread (
+	__xdata FIL *fp,		/* Pointer to the file object */
 	__xdata void* buff,		/* Pointer to the read buffer (NULL:Forward data to the stream)*/
 	UINT btr,				/* Number of bytes to read */
 	__xdata UINT* br		/* Pointer to number of bytes read */
-) __reentrant
+) PF_REENTRANT
 {
-	DRESULT dr;
-	CLUST clst;
-	DWORD sect, remain;
+	FRESULT res;
+	DWORD remain;
 	UINT rcnt;
-	BYTE cs;
 	__xdata BYTE *rbuff = buff;
-	__xdata FATFS *fs = FatFs;
 
 
 	*br = 0;
-	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
-	if (!(fs->flag & FA_OPENED)) return FR_NOT_OPENED;	/* Check if opened */
+	res = validate(fp);					/* Check validity of the file object */
+	if (res != FR_OK) return res;
+	fp->flag &= ~FA__RIP;				/* Cancel an incremental read */
 
-	remain = fs->fsize - fs->fptr;
+	remain = fp->fsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;			/* Truncate btr by remaining bytes */
 
 	while (btr)	{									/* Repeat until all data transferred */
-		if ((fs->fptr % 512) == 0) {				/* On the sector boundary? */
-			cs = (BYTE)(fs->fptr / 512 & (fs->csize - 1));	/* Sector offset in the cluster */
-			if (!cs) {								/* On the cluster boundary? */
-				if (fs->fptr == 0) {				/* On the top of the file? */
-					clst = fs->org_clust;
-				} else {
-					clst = get_fat(fs->curr_clust);
-				}
-				if (clst <= 1) ABORT(FR_DISK_ERR);
-				fs->curr_clust = clst;				/* Update current cluster */
-			}
-			sect = clust2sect(fs->curr_clust);		/* Get current sector */
-			if (!sect) ABORT(FR_DISK_ERR);
-			fs->dsect = sect + cs;
-		}
-		rcnt = 512 - (UINT)fs->fptr % 512;			/* Get partial sector data from sector buffer */
-		if (rcnt > btr) rcnt = btr;
-		dr = disk_readp(rbuff, fs->dsect, (UINT)fs->fptr % 512, rcnt);
-		if (dr) ABORT(FR_DISK_ERR);
-		fs->fptr += rcnt;							/* Advances file read pointer */
+		rcnt = read_part(fp, rbuff, btr);
+		if (!rcnt) ABORT(FR_DISK_ERR);
 		btr -= rcnt; *br += rcnt;					/* Update read counter */
 		if (rbuff) rbuff += rcnt;					/* Advances the data pointer if destination is memory */
 	}
 
 	return FR_OK;
 }
+
+
+FRESULT pf_read (
+	__xdata void* buff,		/* Pointer to the read buffer (NULL:Forward data to the stream)*/
+	UINT btr,				/* Number of bytes to read */
+	__xdata UINT* br		/* Pointer to number of bytes read */
+) PF_REENTRANT
+{
+	__xdata FATFS *fs = FatFs;
+
+
+	*br = 0;
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+
+	return pf_fread(&fs->file, buff, btr, br);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Ahead                                                            */
+/*-----------------------------------------------------------------------*/
+/* Once a read consumes the end of a sector, the next sector of that file
+/  is known from the data sector and the cluster chain. pf_prefetch() loads
+/  it into the spare sector buffer so the following reads are copies. It is
+/  meant to be called when there is nothing else to do. */
+
+#if PF_USE_READ && PF_USE_PREFETCH
+FRESULT pf_prefetch (void) PF_REENTRANT
+{
+	CLUST clst;
+	DWORD sect;
+	__xdata FIL *fp = PfFile;
+	__xdata FATFS *fs = FatFs;
+
+
+	PfFile = 0;
+	if (!fp || validate(fp) != FR_OK) return FR_OK;		/* Nothing to read ahead */
+	if ((fp->fptr % 512) || fp->fptr >= fp->fsize) return FR_OK;
+
+	if (fp->fptr / 512 & (fs->csize - 1)) {		/* Next sector is in the same cluster */
+		sect = fp->dsect + 1;
+	} else {									/* Next sector is in the following cluster */
+		clst = get_fat(fp->curr_clust);
+		if (clst <= 1 || clst >= fs->n_fatent) return FR_DISK_ERR;
+		PfClst = fp->curr_clust; PfNext = clst;	/* Remember the link for read_part() */
+		sect = clust2sect(clst);
+		if (!sect) return FR_DISK_ERR;
+	}
+
+	return sect_load(sect) ? FR_OK : FR_DISK_ERR;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Incremental Read File                                                 */
+/*-----------------------------------------------------------------------*/
+/* pf_read_start() records the request in the file object without touching
+/  the disk, then each pf_read_step() call transfers at most up to the end
+/  of the current sector and returns FR_IN_PROGRESS until the last part has
+/  been read, so a long read can be spread over a main loop. */
+
+FRESULT pf_fread_start (
+	__xdata FIL *fp,		/* Pointer to the file object */
+	__xdata void* buff,		/* Pointer to the read buffer (NULL:Forward data to the stream)*/
+	UINT btr				/* Number of bytes to read */
+) PF_REENTRANT
+{
+	FRESULT res;
+	DWORD remain;
+
+
+	res = validate(fp);					/* Check validity of the file object */
+	if (res != FR_OK) return res;
+
+	remain = fp->fsize - fp->fptr;
+	if (btr > remain) btr = (UINT)remain;			/* Truncate btr by remaining bytes */
+
+	fp->rbuff = buff;
+	fp->rremain = btr;
+	fp->flag |= FA__RIP;
+
+	return FR_OK;
+}
+
+
+FRESULT pf_fread_step (	/* FR_IN_PROGRESS:More to read, FR_OK:Read completed, Else:Error */
+	__xdata FIL *fp,		/* Pointer to the file object */
+	__xdata UINT* br		/* Pointer to number of bytes read by this call */
+) PF_REENTRANT
+{
+	FRESULT res;
+	UINT rcnt;
+
+
+	*br = 0;
+	res = validate(fp);					/* Check validity of the file object */
+	if (res != FR_OK) return res;
+	if (!(fp->flag & FA__RIP)) return FR_OK;	/* Nothing pending */
+
+	if (fp->rremain) {
+		rcnt = read_part(fp, fp->rbuff, fp->rremain);
+		if (!rcnt) ABORT(FR_DISK_ERR);
+		fp->rremain -= rcnt; *br = rcnt;
+		if (fp->rbuff) fp->rbuff += rcnt;
+	}
+	if (fp->rremain) return FR_IN_PROGRESS;
+	fp->flag &= ~FA__RIP;
+
+	return FR_OK;
+}
+
+
+FRESULT pf_read_start (
+	__xdata void* buff,		/* Pointer to the read buffer (NULL:Forward data to the stream)*/
+	UINT btr				/* Number of bytes to read */
+) PF_REENTRANT
+{
+	__xdata FATFS *fs = FatFs;
+
+
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+
+	return pf_fread_start(&fs->file, buff, btr);
+}
+
+
+FRESULT pf_read_step (	/* FR_IN_PROGRESS:More to read, FR_OK:Read completed, Else:Error */
+	__xdata UINT* br		/* Pointer to number of bytes read by this call */
+) PF_REENTRANT
+{
+	__xdata FATFS *fs = FatFs;
+
+
+	*br = 0;
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+
+	return pf_fread_step(&fs->file, br);
+}
 #endif
 
 
@@ -986,67 +1792,127 @@ FRESULT pf_read (
 /*-----------------------------------------------------------------------*/
 #if PF_USE_WRITE
 
-FRESULT pf_write (
+FRESULT pf_fwrite (
+	__xdata FIL *fp,			/* Pointer to the file object */
 	const __xdata void* buff,	/* Pointer to the data to be written */
 	UINT btw,					/* Number of bytes to write (0:Finalize the current write operation) */
 	__xdata UINT* bw			/* Pointer to number of bytes written */
-) __reentrant
+) PF_REENTRANT
 {
+	FRESULT res;
 	CLUST clst;
-	DWORD sect, remain;
-	const BYTE *p = buff;
+	DWORD sect;
+#if !PF_USE_GROW
+	DWORD remain;
+#endif
+	const __xdata BYTE *p = buff;
 	BYTE cs;
 	UINT wcnt;
 	__xdata FATFS *fs = FatFs;
 
 
 	*bw = 0;
-	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
-	if (!(fs->flag & FA_OPENED)) return FR_NOT_OPENED;	/* Check if opened */
+	res = validate(fp);					/* Check validity of the file object */
+	if (res != FR_OK) return res;
 
 	if (!btw) {		/* Finalize request */
-		if ((fs->flag & FA__WIP) && disk_writep(0, 0)) ABORT(FR_DISK_ERR);
-		fs->flag &= ~FA__WIP;
+		if ((fp->flag & FA__WIP) && disk_writep(0, 0)) ABORT(FR_DISK_ERR);
+		fp->flag &= ~FA__WIP;
+#if PF_USE_GROW
+		if (sync_file(fp)) ABORT(FR_DISK_ERR);	/* Record the new size */
+#endif
 		return FR_OK;
 	} else {		/* Write data request */
-		if (!(fs->flag & FA__WIP)) {	/* Round-down fptr to the sector boundary */
-			fs->fptr &= 0xFFFFFE00;
+		if (!(fp->flag & FA__WIP)) {
+#if PF_USE_GROW
+			if ((UINT)fp->fptr % 512) {		/* Resume in the middle of a sector: rewrite its head */
+				if (move_window(fp->dsect, CACHE_DATA)) ABORT(FR_DISK_ERR);
+				WinSect = 0;				/* Win is going stale */
+#if PF_USE_PREFETCH
+				sect_drop(fp->dsect);
+#endif
+#if PF_USE_CACHE
+				cache_invalidate(fp->dsect);
+#endif
+				if (disk_writep(0, fp->dsect) || disk_writep(Win, (UINT)fp->fptr % 512)) ABORT(FR_DISK_ERR);
+				fp->flag |= FA__WIP;
+			}
+#else
+			fp->fptr &= 0xFFFFFE00;		/* Round-down fptr to the sector boundary */
+#endif
 		}
 	}
-	remain = fs->fsize - fs->fptr;
+#if !PF_USE_GROW
+	remain = fp->fsize - fp->fptr;
 	if (btw > remain) btw = (UINT)remain;			/* Truncate btw by remaining bytes */
+#endif
 
 	while (btw)	{									/* Repeat until all data transferred */
-		if ((UINT)fs->fptr % 512 == 0) {			/* On the sector boundary? */
-			cs = (BYTE)(fs->fptr / 512 & (fs->csize - 1));	/* Sector offset in the cluster */
+		if ((UINT)fp->fptr % 512 == 0) {			/* On the sector boundary? */
+			cs = (BYTE)(fp->fptr / 512 & (fs->csize - 1));	/* Sector offset in the cluster */
 			if (!cs) {								/* On the cluster boundary? */
-				if (fs->fptr == 0) {				/* On the top of the file? */
-					clst = fs->org_clust;
+				if (fp->fptr == 0) {				/* On the top of the file? */
+					clst = fp->org_clust;
 				} else {
-					clst = get_fat(fs->curr_clust);
+					clst = get_fat(fp->curr_clust);
+				}
+#if PF_USE_GROW
+				if (!clst || clst >= fs->n_fatent) {	/* Past the last cluster, allocate one */
+					res = grow_chain(fp, fp->fptr ? fp->curr_clust : 0, 1);
+					if (res != FR_OK) ABORT(res);
+					clst = fp->fptr ? fs->last_clust : fp->org_clust;
 				}
+#endif
 				if (clst <= 1) ABORT(FR_DISK_ERR);
-				fs->curr_clust = clst;				/* Update current cluster */
+				fp->curr_clust = clst;				/* Update current cluster */
 			}
-			sect = clust2sect(fs->curr_clust);		/* Get current sector */
+			sect = clust2sect(fp->curr_clust);		/* Get current sector */
 			if (!sect) ABORT(FR_DISK_ERR);
-			fs->dsect = sect + cs;
-			if (disk_writep(0, fs->dsect)) ABORT(FR_DISK_ERR);	/* Initiate a sector write operation */
-			fs->flag |= FA__WIP;
+			fp->dsect = sect + cs;
+#if PF_USE_PREFETCH
+			sect_drop(fp->dsect);					/* Buffered copy is going stale */
+#endif
+#if PF_USE_CACHE
+			cache_invalidate(fp->dsect);
+#endif
+			if (disk_writep(0, fp->dsect)) ABORT(FR_DISK_ERR);	/* Initiate a sector write operation */
+			fp->flag |= FA__WIP;
 		}
-		wcnt = 512 - (UINT)fs->fptr % 512;			/* Number of bytes to write to the sector */
+		wcnt = 512 - (UINT)fp->fptr % 512;			/* Number of bytes to write to the sector */
 		if (wcnt > btw) wcnt = btw;
 		if (disk_writep(p, wcnt)) ABORT(FR_DISK_ERR);	/* Send data to the sector */
-		fs->fptr += wcnt; p += wcnt;				/* Update pointers and counters */
+		fp->fptr += wcnt; p += wcnt;				/* Update pointers and counters */
 		btw -= wcnt; *bw += wcnt;
-		if ((UINT)fs->fptr % 512 == 0) {
+#if PF_USE_GROW
+		if (fp->fptr > fp->fsize) {					/* Extend the file */
+			fp->fsize = fp->fptr;
+			fp->flag |= FA__DIRTY;
+		}
+#endif
+		if ((UINT)fp->fptr % 512 == 0) {
 			if (disk_writep(0, 0)) ABORT(FR_DISK_ERR);	/* Finalize the currtent secter write operation */
-			fs->flag &= ~FA__WIP;
+			fp->flag &= ~FA__WIP;
 		}
 	}
 
 	return FR_OK;
 }
+
+
+FRESULT pf_write (
+	const __xdata void* buff,	/* Pointer to the data to be written */
+	UINT btw,					/* Number of bytes to write (0:Finalize the current write operation) */
+	__xdata UINT* bw			/* Pointer to number of bytes written */
+) PF_REENTRANT
+{
+	__xdata FATFS *fs = FatFs;
+
+
+	*bw = 0;
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+
+	return pf_fwrite(&fs->file, buff, btw, bw);
+}
 #endif
 
 
@@ -1056,48 +1922,191 @@ FRESULT pf_write (
 /*-----------------------------------------------------------------------*/
 #if PF_USE_LSEEK
 
-FRESULT pf_lseek (
-	DWORD ofs		/* File pointer from top of file */
-) __reentrant
+FRESULT pf_flseek (
+	__xdata FIL *fp,	/* Pointer to the file object */
+	DWORD ofs			/* File pointer from top of file */
+) PF_REENTRANT
 {
+	FRESULT res;
 	CLUST clst;
 	DWORD bcs, sect, ifptr;
 	__xdata FATFS *fs = FatFs;
 
 
-	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
-	if (!(fs->flag & FA_OPENED)) return FR_NOT_OPENED;	/* Check if opened */
+	res = validate(fp);					/* Check validity of the file object */
+	if (res != FR_OK) return res;
 
-	if (ofs > fs->fsize) ofs = fs->fsize;	/* Clip offset with the file size */
-	ifptr = fs->fptr;
-	fs->fptr = 0;
+	if (ofs > fp->fsize) ofs = fp->fsize;	/* Clip offset with the file size */
+	fp->flag &= ~FA__RIP;				/* Cancel an incremental read */
+#if PF_USE_PREFETCH
+	if (PfFile == fp) PfFile = 0;		/* Cancel the read ahead */
+#endif
+	ifptr = fp->fptr;
+	fp->fptr = 0;
 	if (ofs > 0) {
 		bcs = (DWORD)fs->csize * 512;		/* Cluster size (byte) */
 		if (ifptr > 0 &&
 			(ofs - 1) / bcs >= (ifptr - 1) / bcs) {	/* When seek to same or following cluster, */
-			fs->fptr = (ifptr - 1) & ~(bcs - 1);	/* start from the current cluster */
-			ofs -= fs->fptr;
-			clst = fs->curr_clust;
+			fp->fptr = (ifptr - 1) & ~(bcs - 1);	/* start from the current cluster */
+			ofs -= fp->fptr;
+			clst = fp->curr_clust;
 		} else {							/* When seek to back cluster, */
-			clst = fs->org_clust;			/* start from the first cluster */
-			fs->curr_clust = clst;
+			clst = fp->org_clust;			/* start from the first cluster */
+			fp->curr_clust = clst;
 		}
 		while (ofs > bcs) {				/* Cluster following loop */
 			clst = get_fat(clst);		/* Follow cluster chain */
 			if (clst <= 1 || clst >= fs->n_fatent) ABORT(FR_DISK_ERR);
-			fs->curr_clust = clst;
-			fs->fptr += bcs;
+			fp->curr_clust = clst;
+			fp->fptr += bcs;
 			ofs -= bcs;
 		}
-		fs->fptr += ofs;
+		fp->fptr += ofs;
 		sect = clust2sect(clst);		/* Current sector */
 		if (!sect) ABORT(FR_DISK_ERR);
-		fs->dsect = sect + (fs->fptr / 512 & (fs->csize - 1));
+		fp->dsect = sect + (fp->fptr / 512 & (fs->csize - 1));
+	}
+
+	return FR_OK;
+}
+
+
+FRESULT pf_lseek (
+	DWORD ofs		/* File pointer from top of file */
+) PF_REENTRANT
+{
+	__xdata FATFS *fs = FatFs;
+
+
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+
+	return pf_flseek(&fs->file, ofs);
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Preallocate File                                                      */
+/*-----------------------------------------------------------------------*/
+/* Extends the allocation of a file to at least size bytes in one pass,
+/  taking the new clusters as a single contiguous run that follows on from
+/  the file's last cluster where possible, so a file expanded from empty is
+/  in one piece. The file size is set to size if that is larger; the new
+/  space holds whatever the clusters held before. Fails with FR_DENIED when
+/  there are enough free clusters but no run long enough, FR_DISK_FULL when
+/  there aren't. */
+#if PF_USE_WRITE && PF_USE_GROW
+
+FRESULT pf_fexpand (
+	__xdata FIL *fp,	/* Pointer to the file object */
+	DWORD size			/* Number of bytes to allocate for */
+) PF_REENTRANT
+{
+	FRESULT res;
+	CLUST clst, last, have, need;
+	DWORD bcs;
+	__xdata FATFS *fs = FatFs;
+
+
+	res = validate(fp);					/* Check validity of the file object */
+	if (res != FR_OK) return res;
+	if (fp->flag & FA__WIP) return FR_NOT_READY;	/* A sector write is in progress */
+
+	bcs = (DWORD)fs->csize * 512;		/* Cluster size (byte) */
+	need = (CLUST)((size + bcs - 1) / bcs);
+	have = 0; last = 0;
+	for (clst = fp->org_clust; clst >= 2 && clst < fs->n_fatent; clst = get_fat(clst)) {	/* Find the end of the chain */
+		last = clst;
+		have++;
+	}
+	if (clst == 1) ABORT(FR_DISK_ERR);
+
+	if (need > have) {
+		res = grow_chain(fp, last, need - have);
+		if (res != FR_OK) return res;	/* The file itself is still intact */
+	}
+	if (size > fp->fsize) {
+		fp->fsize = size;
+		fp->flag |= FA__DIRTY;
+	}
+
+	return sync_file(fp) ? FR_DISK_ERR : FR_OK;
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the Sector Extent of a Contiguous File                            */
+/*-----------------------------------------------------------------------*/
+/* For callers that write or read the file's sectors directly, bypassing
+/  the file functions. Fails with FR_FRAGMENTED unless the clusters are
+/  consecutive. */
+
+FRESULT pf_fextent (
+	__xdata FIL *fp,		/* Pointer to the file object */
+	__xdata DWORD *sect,	/* First sector of the file */
+	__xdata DWORD *count	/* Number of sectors allocated to the file */
+) PF_REENTRANT
+{
+	FRESULT res;
+	CLUST clst, next;
+	__xdata FATFS *fs = FatFs;
+
+
+	*sect = 0; *count = 0;
+	res = validate(fp);					/* Check validity of the file object */
+	if (res != FR_OK) return res;
+
+	clst = fp->org_clust;
+	if (!clst) return FR_OK;			/* Nothing allocated */
+	*sect = clust2sect(clst);
+	if (!*sect) return FR_DISK_ERR;
+	for (;;) {
+		*count += fs->csize;
+		next = get_fat(clst);
+		if (next == 1) return FR_DISK_ERR;
+		if (next < 2 || next >= fs->n_fatent) break;	/* End of the chain */
+		if (next != clst + 1) return FR_FRAGMENTED;
+		clst = next;
 	}
 
 	return FR_OK;
 }
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Invalidate Buffered Sectors                                           */
+/*-----------------------------------------------------------------------*/
+/* For callers that write sectors directly, e.g. into the extent from
+/  pf_fextent(): drops the copies of those sectors that the cache, the
+/  sector buffers and the directory buffer hold. Call it before reading
+/  them back through pff. */
+
+void pf_invalidate (
+	DWORD sect,		/* First sector written */
+	DWORD count		/* Number of sectors written */
+) PF_REENTRANT
+{
+	for ( ; count; sect++, count--) {
+#if PF_USE_CACHE
+		cache_invalidate(sect);
+#endif
+#if PF_USE_PREFETCH
+		sect_drop(sect);
+#endif
+#if PF_USE_DIRBUF
+		if (DirSect == sect) DirSect = 0;
 #endif
+#if PF_USE_WRITE && PF_USE_GROW
+		if (WinSect == sect && !WinDirty) WinSect = 0;
+#endif
+	}
+}
 
 
 
@@ -1109,22 +2118,23 @@ FRESULT pf_lseek (
 FRESULT pf_opendir (
 	__xdata DIR *dj,			/* Pointer to directory object to create */
 	const __code char *path		/* Pointer to the directory path */
-) __reentrant
+) PF_REENTRANT
 {
 	FRESULT res;
-	BYTE sp[12], dir[32];
+	PF_HOT static BYTE sp[12];
+	PF_HOT static BYTE dir[32];
 	__xdata FATFS *fs = FatFs;
 
 
 	if (!fs) {				/* Check file system */
 		res = FR_NOT_ENABLED;
 	} else {
-		dj->fn = sp;
-		res = follow_path(dj, dir, path);		/* Follow the path to the directory */
+		dj->fn = HOT(sp);
+		res = follow_path(dj, HOT(dir), path);		/* Follow the path to the directory */
 		if (res == FR_OK) {						/* Follow completed */
 			if (dir[0]) {						/* It is not the root dir */
 				if (dir[DIR_Attr] & AM_DIR) {	/* The object is a directory */
-					dj->sclust = get_clust(dir);
+					dj->sclust = get_clust(HOT(dir));
 				} else {							/* The object is not a directory */
 					res = FR_NO_FILE;
 				}
@@ -1148,25 +2158,25 @@ FRESULT pf_opendir (
 FRESULT pf_readdir (
 	__xdata DIR *dj,			/* Pointer to the open directory object */
 	__xdata FILINFO *fno		/* Pointer to file information to return */
-) __reentrant
+) PF_REENTRANT
 {
 	FRESULT res;
-	__xdata BYTE sp[12];
-	__xdata dir[32];
+	PF_HOT static BYTE sp[12];
+	PF_HOT static BYTE dir[32];
 	__xdata FATFS *fs = FatFs;
 
 
 	if (!fs) {				/* Check file system */
 		res = FR_NOT_ENABLED;
 	} else {
-		dj->fn = sp;
+		dj->fn = HOT(sp);
 		if (!fno) {
 			res = dir_rewind(dj);
 		} else {
-			res = dir_read(dj, dir);	/* Get current directory item */
+			res = dir_read(dj, HOT(dir));	/* Get current directory item */
 			if (res == FR_NO_FILE) res = FR_OK;
 			if (res == FR_OK) {				/* A valid entry is found */
-				get_fileinfo(dj, dir, fno);	/* Get the object information */
+				get_fileinfo(dj, HOT(dir), fno);	/* Get the object information */
 				res = dir_next(dj);			/* Increment read index for next */
 				if (res == FR_NO_FILE) res = FR_OK;
 			}
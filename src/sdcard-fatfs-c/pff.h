@@ -58,23 +58,49 @@ typedef unsigned long	DWORD;	/* 32-bit unsigned integer */
 #endif
 
 
+/* File object structure */
+
+typedef struct {
+	BYTE	flag;		/* File status flags */
+	BYTE	pad1;
+	WORD	id;			/* Mount ID of the file system it was opened on */
+	DWORD	fptr;		/* File R/W pointer */
+	DWORD	fsize;		/* File size */
+	CLUST	org_clust;	/* File start cluster */
+	CLUST	curr_clust;	/* File current cluster */
+	DWORD	dsect;		/* File current data sector */
+#if PF_USE_READ
+	__xdata BYTE*	rbuff;	/* Incremental read destination (NULL:Forward data to the stream) */
+	UINT	rremain;	/* Incremental read bytes still to be transferred */
+#endif
+#if PF_USE_WRITE && PF_USE_GROW
+	DWORD	dir_sect;	/* Sector holding the directory entry */
+	WORD	dir_ofs;	/* Offset of the directory entry in the sector */
+#endif
+} FIL;
+
+
+
 /* File system object structure */
 
 typedef struct {
 	BYTE	fs_type;	/* FAT sub type */
-	BYTE	flag;		/* File status flags */
 	BYTE	csize;		/* Number of sectors per cluster */
-	BYTE	pad1;
+	WORD	id;			/* Mount ID */
 	WORD	n_rootdir;	/* Number of root directory entries (0 on FAT32) */
 	CLUST	n_fatent;	/* Number of FAT entries (= number of clusters + 2) */
 	DWORD	fatbase;	/* FAT start sector */
 	DWORD	dirbase;	/* Root directory start sector (Cluster# on FAT32) */
 	DWORD	database;	/* Data start sector */
-	DWORD	fptr;		/* File R/W pointer */
-	DWORD	fsize;		/* File size */
-	CLUST	org_clust;	/* File start cluster */
-	CLUST	curr_clust;	/* File current cluster */
-	DWORD	dsect;		/* File current data sector */
+#if PF_USE_WRITE && PF_USE_GROW
+	BYTE	n_fats;		/* Number of FAT copies */
+	BYTE	fsi_flag;	/* FSInfo needs to be written back */
+	DWORD	fsize;		/* Number of sectors per FAT */
+	DWORD	fsi_sect;	/* FSInfo sector (0:None) */
+	CLUST	last_clust;	/* Last allocated cluster, free cluster search starts after it */
+	CLUST	free_clust;	/* Number of free clusters (0xFFFFFFFF:Unknown) */
+#endif
+	FIL		file;		/* File object used by the single file functions */
 } FATFS;
 
 
@@ -112,7 +138,12 @@ typedef enum {
 	FR_NO_FILE,			/* 3 */
 	FR_NOT_OPENED,		/* 4 */
 	FR_NOT_ENABLED,		/* 5 */
-	FR_NO_FILESYSTEM	/* 6 */
+	FR_NO_FILESYSTEM,	/* 6 */
+	FR_IN_PROGRESS,		/* 7 */
+	FR_OUT_OF_RANGE,	/* 8 */
+	FR_DISK_FULL,		/* 9 */
+	FR_FRAGMENTED,		/* 10 */
+	FR_DENIED			/* 11 */
 } FRESULT;
 
 
@@ -120,13 +151,29 @@ typedef enum {
 /*--------------------------------------------------------------*/
 /* Petit FatFs module application interface                     */
 
-FRESULT pf_mount (__xdata FATFS* fs) __reentrant;										/* Mount/Unmount a logical drive */
-FRESULT pf_open (const __code char* path) __reentrant;									/* Open a file */
-FRESULT pf_read (__xdata void* buff, UINT btr, __xdata UINT* br) __reentrant;			/* Read data from the open file */
-FRESULT pf_write (const __xdata void* buff, UINT btw, __xdata UINT* bw) __reentrant;		/* Write data to the open file */
-FRESULT pf_lseek (DWORD ofs) __reentrant;												/* Move file pointer of the open file */
-FRESULT pf_opendir (__xdata DIR* dj, const __code char* path) __reentrant;				/* Open a directory */
-FRESULT pf_readdir (__xdata DIR* dj, __xdata FILINFO* fno) __reentrant;					/* Read a directory item from the open directory */
+FRESULT pf_mount (__xdata FATFS* fs) PF_REENTRANT;										/* Mount/Unmount a logical drive */
+FRESULT pf_open (const __code char* path) PF_REENTRANT;									/* Open a file */
+FRESULT pf_read (__xdata void* buff, UINT btr, __xdata UINT* br) PF_REENTRANT;			/* Read data from the open file */
+FRESULT pf_read_start (__xdata void* buff, UINT btr) PF_REENTRANT;						/* Start an incremental read from the open file */
+FRESULT pf_read_step (__xdata UINT* br) PF_REENTRANT;									/* Continue the incremental read by up to one sector */
+FRESULT pf_write (const __xdata void* buff, UINT btw, __xdata UINT* bw) PF_REENTRANT;		/* Write data to the open file */
+FRESULT pf_lseek (DWORD ofs) PF_REENTRANT;												/* Move file pointer of the open file */
+FRESULT pf_opendir (__xdata DIR* dj, const __code char* path) PF_REENTRANT;				/* Open a directory */
+FRESULT pf_readdir (__xdata DIR* dj, __xdata FILINFO* fno) PF_REENTRANT;					/* Read a directory item from the open directory */
+
+/* Functions on a file object, any number of files can be open at once */
+FRESULT pf_fopen (__xdata FIL* fp, const __code char* path) PF_REENTRANT;
+FRESULT pf_fread (__xdata FIL* fp, __xdata void* buff, UINT btr, __xdata UINT* br) PF_REENTRANT;
+FRESULT pf_fread_start (__xdata FIL* fp, __xdata void* buff, UINT btr) PF_REENTRANT;
+FRESULT pf_fread_step (__xdata FIL* fp, __xdata UINT* br) PF_REENTRANT;
+FRESULT pf_fwrite (__xdata FIL* fp, const __xdata void* buff, UINT btw, __xdata UINT* bw) PF_REENTRANT;
+FRESULT pf_flseek (__xdata FIL* fp, DWORD ofs) PF_REENTRANT;
+FRESULT pf_fexpand (__xdata FIL* fp, DWORD size) PF_REENTRANT;		/* Preallocate a contiguous run of clusters */
+FRESULT pf_fextent (__xdata FIL* fp, __xdata DWORD* sect, __xdata DWORD* count) PF_REENTRANT;	/* Sectors of a contiguous file */
+void pf_invalidate (DWORD sect, DWORD count) PF_REENTRANT;	/* Drop buffered copies of sectors written behind pff's back */
+
+/* Read ahead the next sector of the file read last (call when idle) */
+FRESULT pf_prefetch (void) PF_REENTRANT;
 
 
 
@@ -134,9 +181,11 @@ FRESULT pf_readdir (__xdata DIR* dj, __xdata FILINFO* fno) __reentrant;					/* R
 /* Flags and offset address                                     */
 
 
-/* File status flag (FATFS.flag) */
+/* File status flag (FIL.flag) */
 #define	FA_OPENED	0x01
 #define	FA_WPRT		0x02
+#define	FA__DIRTY	0x10
+#define	FA__RIP		0x20
 #define	FA__WIP		0x40
 
 
@@ -9,14 +9,58 @@
 / Function Configurations (0:Disable, 1:Enable)
 /---------------------------------------------------------------------------*/
 
+/* The settings in #ifndef can be overridden from the Makefile (PFCONF=...) */
+
 #define	PF_USE_READ		1	/* pf_read() function */
+#ifndef PF_USE_DIR
 #define	PF_USE_DIR		0	/* pf_opendir() and pf_readdir() function */
+#endif
+#ifndef PF_USE_LSEEK
 #define	PF_USE_LSEEK	0	/* pf_lseek() function */
+#endif
+#ifndef PF_USE_WRITE
 #define	PF_USE_WRITE	0	/* pf_write() function */
+#endif
+#ifndef PF_USE_GROW
+#define	PF_USE_GROW		PF_USE_WRITE	/* Extend files past their size and pf_fexpand() (needs PF_USE_WRITE) */
+#endif
+
+#ifndef PF_USE_DIRBUF
+#define PF_USE_DIRBUF	0	/* Read directories a sector at a time (512 bytes of XRAM) */
+#endif
+#ifndef PF_USE_PREFETCH
+#define PF_USE_PREFETCH	0	/* Buffer file sectors and read the next one ahead (1 KiB of XRAM) */
+#endif
+#ifndef PF_USE_CACHE
+#define PF_USE_CACHE	0	/* Read through the set associative sector cache in cache.c (see cache.h) */
+#endif
+#ifndef PF_USE_INDEX
+#define PF_USE_INDEX	0	/* Index directory names for repeated pf_open() (needs PF_USE_DIRBUF) */
+#endif
+#define PF_INDEX_SIZE	1024	/* XRAM budget of the name index in bytes */
+#define PF_INDEX_DIRS	4	/* Number of directories the name index can hold (1..8) */
+
+#ifndef PF_REENTRANT
+#define PF_REENTRANT	__reentrant	/* SD and FAT stack functions reentrant (make NOREENT=1 MODEL=large makes them static) */
+#endif
+
+#ifndef PF_SD_REENTRANT
+#define PF_SD_REENTRANT	__reentrant	/* Per block SD driver functions with small frames (make NOREENT=sd makes them static) */
+#endif
+
+#ifndef PF_USE_PDATA
+#define PF_USE_PDATA	0	/* Small hot buffers in the pdata page (set by make PDATA=1) */
+#endif
 
+#ifndef PF_FS_FAT12
 #define PF_FS_FAT12		0	/* FAT12 */
+#endif
+#ifndef PF_FS_FAT16
 #define PF_FS_FAT16		0	/* FAT16 */
+#endif
+#ifndef PF_FS_FAT32
 #define PF_FS_FAT32		1	/* FAT32 */
+#endif
 
 
 /*---------------------------------------------------------------------------/
@@ -0,0 +1,50 @@
+#ifndef PT_H
+#define PT_H
+
+#include <stdint.h>
+
+// stackless protothreads. a thread is a function that resumes at the line
+// it last waited on via a switch statement, so each thread costs two bytes
+// of state instead of a stack. locals are NOT preserved across a wait or
+// yield, keep anything that must survive in statics.
+//
+// don't use switch statements inside a protothread body.
+
+struct pt {
+    uint16_t lc;
+};
+
+#define PT_WAITING  0
+#define PT_YIELDED  1
+#define PT_EXITED   2
+#define PT_ENDED    3
+
+#define PT_THREAD(decl) char decl
+
+#define PT_INIT(pt) ((pt)->lc = 0)
+
+#define PT_BEGIN(pt) { char pt_yielded = 1; (void) pt_yielded; \
+        switch ((pt)->lc) { case 0:
+
+#define PT_END(pt) } PT_INIT(pt); return PT_ENDED; }
+
+// block until cond is true
+#define PT_WAIT_UNTIL(pt, cond) do {            \
+        (pt)->lc = __LINE__; case __LINE__:     \
+        if (!(cond)) return PT_WAITING;         \
+    } while (0)
+
+#define PT_WAIT_WHILE(pt, cond) PT_WAIT_UNTIL((pt), !(cond))
+
+// give the other threads one turn
+#define PT_YIELD(pt) do {                       \
+        pt_yielded = 0;                         \
+        (pt)->lc = __LINE__; case __LINE__:     \
+        if (!pt_yielded) return PT_YIELDED;     \
+    } while (0)
+
+#define PT_RESTART(pt) do { PT_INIT(pt); return PT_WAITING; } while (0)
+
+#define PT_EXIT(pt) do { PT_INIT(pt); return PT_EXITED; } while (0)
+
+#endif /* PT_H */
@@ -0,0 +1,291 @@
+#include <8051.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "diskio.h"
+#include "fpage.h"
+#include "pff.h"
+#include "timebase.h"
+#include "xmem.h"
+
+// benchmark of the fat paths. the firmware build runs in the simulator
+// against diskio_sim.c, with results going out of the on-chip serial port
+// as "<phase> <cycles>" lines, ending with "done", for tools/build-matrix.py
+// and tools/pff-matrix.py. host/bench.c runs simbench() natively against
+// images made by tools/mkfatimg.py, where the timebase counts card transfers
+// instead of cycles. phases that need a disabled pffconf.h option are left
+// out.
+//
+// the file read is 64 KiB with mkfatimg's contents, byte i of the file with
+// seed s being (i ^ (i >> 8) ^ s) & 0xFF.
+
+#define STREAM_SIZE 65536UL
+#define SMALL_CHUNK 16
+#define OPEN_REPEAT 8
+#define SEEK_REPEAT 64
+
+static const __code char* stream_path;
+static uint8_t stream_seed;
+static uint16_t errors;
+static uint16_t checksum;
+
+#ifndef HOST_BENCH
+
+// 9600 baud from timer 1, timer 0 is left to the timebase
+static void serial_setup(void) {
+    SCON = 0x50;
+    TMOD = (TMOD & 0x0F) | 0x20;
+    TH1 = 0xFD;
+    TL1 = 0xFD;
+    TR1 = 1;
+    TI = 1;
+}
+
+int putchar(int c) {
+    while (!TI);
+    TI = 0;
+    SBUF = c;
+    return 0;
+}
+
+#endif
+
+// print a 32 bit count, printf_tiny can't
+static void print_phase(const __code char* phase, uint32_t n) {
+    __xdata static char digits[11];
+    uint8_t i = sizeof digits - 1;
+
+    digits[i] = 0;
+    do {
+        digits[--i] = '0' + (uint8_t) (n % 10);
+        n /= 10;
+    } while (n);
+    printf_tiny("%s ", phase);
+    while (digits[i]) {
+        putchar(digits[i++]);
+    }
+    printf_tiny("\r\n");
+}
+
+// byte of the file at an offset
+static uint8_t expected(uint32_t ofs) {
+    return (uint8_t) ofs ^ (uint8_t) (ofs >> 8) ^ stream_seed;
+}
+
+// check a buffer read from the file at an offset
+static void verify(__xdata uint8_t* buff, uint32_t ofs, UINT n) {
+    while (n--) {
+        if (*(buff++) != expected(ofs++)) {
+            errors++;
+        }
+    }
+}
+
+static void checksum_sink(uint8_t b) {
+    checksum += b;
+}
+
+// run the phases on a file of the volume, with its mkfatimg seed
+void simbench(const __code char* path, uint8_t seed) {
+    __xdata static FATFS fs;
+#if PF_USE_LSEEK
+    __xdata static FIL fil;
+    __xdata static FPAGER pager;
+    __xdata static WORD w;
+#endif
+#if PF_USE_DIR
+    __xdata static DIR dir;
+    __xdata static FILINFO fno;
+#endif
+    __xdata static uint8_t buffer[512];
+    __xdata static uint8_t copy[512];
+    __xdata static UINT br;
+    __xdata static UINT got;
+    uint32_t start, ofs, cycles;
+    uint16_t steps;
+    FRESULT res;
+    uint8_t i;
+#if PF_USE_WRITE
+    UINT n;
+#endif
+
+    stream_path = path;
+    stream_seed = seed;
+    start = timebase_cycles();
+    if (pf_mount(&fs) != FR_OK) {
+        printf_tiny("mount failed\r\n");
+        return;
+    }
+    print_phase("mount", timebase_cycles() - start);
+
+    start = timebase_cycles();
+    pf_open(stream_path);
+    print_phase("open-first", timebase_cycles() - start);
+
+    start = timebase_cycles();
+    for (i = 0; i != OPEN_REPEAT; i++) {
+        pf_open(stream_path);
+    }
+    print_phase("open-average", (timebase_cycles() - start) / OPEN_REPEAT);
+
+    // whole file in sector sized reads
+    start = timebase_cycles();
+    for (ofs = 0; ofs != STREAM_SIZE; ofs += sizeof buffer) {
+        if (pf_read(buffer, sizeof buffer, &br) != FR_OK || br != sizeof buffer) {
+            errors++;
+            break;
+        }
+    }
+    print_phase("read-512", timebase_cycles() - start);
+    verify(buffer, STREAM_SIZE - sizeof buffer, sizeof buffer);
+
+    // the same in small pieces, served from the file sector buffers
+    pf_open(stream_path);
+    start = timebase_cycles();
+    for (ofs = 0; ofs != STREAM_SIZE; ofs += SMALL_CHUNK) {
+        if (pf_read(buffer, SMALL_CHUNK, &br) != FR_OK || br != SMALL_CHUNK) {
+            errors++;
+            break;
+        }
+    }
+    print_phase("read-16", timebase_cycles() - start);
+    verify(buffer, STREAM_SIZE - SMALL_CHUNK, SMALL_CHUNK);
+
+    // incremental reads of a sector's worth, each one straddling a sector
+    // boundary so it takes two steps. only the time in pf_read_step() is
+    // counted, every chunk is checked.
+    pf_open(stream_path);
+    pf_read(buffer, SMALL_CHUNK, &br);
+    cycles = 0;
+    steps = 0;
+    for (ofs = SMALL_CHUNK; ofs != STREAM_SIZE; ofs += got) {
+        if (pf_read_start(buffer, sizeof buffer) != FR_OK) {
+            errors++;
+            break;
+        }
+        got = 0;
+        start = timebase_cycles();
+        do {
+            res = pf_read_step(&br);
+            got += br;
+            steps++;
+        } while (res == FR_IN_PROGRESS);
+        cycles += timebase_cycles() - start;
+        if (res != FR_OK || got != (UINT) (STREAM_SIZE - ofs < sizeof buffer ? STREAM_SIZE - ofs : sizeof buffer)) {
+            errors++;
+            break;
+        }
+        verify(buffer, ofs, got);
+    }
+    print_phase("read-step", cycles);
+    print_phase("read-step-calls", steps);
+
+    // forwarded to a sink, no buffer at all
+    pf_open(stream_path);
+    disk_set_sink(checksum_sink);
+    start = timebase_cycles();
+    pf_read(0, 0x8000, &br);
+    pf_read(0, 0x8000, &br);
+    print_phase("read-forward", timebase_cycles() - start);
+    disk_set_sink(0);
+
+#if PF_USE_LSEEK
+    // scattered seeks, each followed by a small read
+    start = timebase_cycles();
+    for (i = 0; i != SEEK_REPEAT; i++) {
+        ofs = (i * 40503UL) % (STREAM_SIZE - SMALL_CHUNK);
+        if (pf_lseek(ofs) != FR_OK || pf_read(buffer, SMALL_CHUNK, &br) != FR_OK) {
+            errors++;
+            break;
+        }
+        verify(buffer, ofs, SMALL_CHUNK);
+    }
+    print_phase("seek-read", timebase_cycles() - start);
+
+    // random access through the pager, 1000 byte stride
+    if (pf_fopen(&fil, stream_path) != FR_OK || fpage_open(&pager, &fil) != FR_OK) {
+        errors++;
+    }
+    start = timebase_cycles();
+    for (ofs = 0; ofs < STREAM_SIZE - 1; ofs += 1000) {
+        if (fpage_word(&pager, ofs, &w) != FR_OK) {
+            errors++;
+            break;
+        }
+    }
+    print_phase("paged-stride", timebase_cycles() - start);
+#endif
+
+#if PF_USE_DIR
+    // list the root directory
+    start = timebase_cycles();
+    if (pf_opendir(&dir, "") != FR_OK) {
+        errors++;
+    } else {
+        while (pf_readdir(&dir, &fno) == FR_OK && fno.fname[0]);
+    }
+    print_phase("list-dir", timebase_cycles() - start);
+#endif
+
+#if PF_USE_WRITE
+    // write the file over with the bytes it already holds, so the volume is
+    // left as it was, and read it back. diskio_sim.c fails writes that don't
+    // match its volume and the host image keeps what was written, so bytes
+    // sent to the wrong sector show up either way. only the time in
+    // pf_write() is counted.
+    pf_open(stream_path);
+    cycles = 0;
+    for (ofs = 0; ofs != STREAM_SIZE; ofs += sizeof buffer) {
+        for (n = 0; n != sizeof buffer; n++) {
+            buffer[n] = expected(ofs + n);
+        }
+        start = timebase_cycles();
+        res = pf_write(buffer, sizeof buffer, &br);
+        cycles += timebase_cycles() - start;
+        if (res != FR_OK || br != sizeof buffer) {
+            errors++;
+            break;
+        }
+    }
+    start = timebase_cycles();
+    if (pf_write(0, 0, &br) != FR_OK) {
+        errors++;
+    }
+    cycles += timebase_cycles() - start;
+    print_phase("write-512", cycles);
+
+    pf_open(stream_path);
+    for (ofs = 0; ofs != STREAM_SIZE; ofs += sizeof buffer) {
+        if (pf_read(buffer, sizeof buffer, &br) != FR_OK || br != sizeof buffer) {
+            errors++;
+            break;
+        }
+        verify(buffer, ofs, sizeof buffer);
+    }
+#endif
+
+    // xram block move
+    start = timebase_cycles();
+    xmem_copy(copy, buffer, sizeof buffer);
+    print_phase("copy-512", timebase_cycles() - start);
+
+    print_phase("card-reads", disk_read_count);
+    print_phase("card-writes", disk_write_count);
+    print_phase("errors", errors);
+}
+
+#ifndef HOST_BENCH
+
+void main(void) {
+    timebase_setup();
+    serial_setup();
+    EA = 1;
+
+    // the file diskio_sim.c puts first in the root directory
+    simbench("STREAM.BIN", 1);
+    printf_tiny("done\r\n");
+    while (1);
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include "task.h"
+
+#define TASK_NONE 0xFF
+
+struct task {
+    task_fn fn;
+    uint8_t flags;
+    struct pt pt;
+};
+
+static __xdata struct task tasks[TASK_MAX];
+
+// slot of the task currently being run by task_run()
+static uint8_t task_current = TASK_NONE;
+
+// set while task_idle() is running so waits inside idle tasks don't recurse
+static __bit task_in_idle;
+
+uint8_t task_add(task_fn fn, uint8_t flags) {
+    uint8_t i;
+    for (i = 0; i != TASK_MAX; i++) {
+        if (!tasks[i].fn) {
+            tasks[i].flags = flags;
+            PT_INIT(&tasks[i].pt);
+            tasks[i].fn = fn;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint8_t task_run(void) {
+    uint8_t i, live = 0;
+    for (i = 0; i != TASK_MAX; i++) {
+        if (!tasks[i].fn) {
+            continue;
+        }
+        task_current = i;
+        if (tasks[i].fn(&tasks[i].pt) >= PT_EXITED) {
+            tasks[i].fn = 0;
+        } else {
+            live++;
+        }
+    }
+    task_current = TASK_NONE;
+    return live;
+}
+
+void task_idle(void) {
+    uint8_t i;
+    if (task_in_idle) {
+        return;
+    }
+    task_in_idle = 1;
+    for (i = 0; i != TASK_MAX; i++) {
+        if (i != task_current && tasks[i].fn && (tasks[i].flags & TASK_IDLE_SAFE)) {
+            if (tasks[i].fn(&tasks[i].pt) >= PT_EXITED) {
+                tasks[i].fn = 0;
+            }
+        }
+    }
+    task_in_idle = 0;
+}
@@ -0,0 +1,30 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <stdint.h>
+
+#include "pt.h"
+
+// tiny cooperative run queue of protothreads. the table lives in xdata, so
+// the only internal ram cost is the call stack of whichever task is running.
+
+#define TASK_MAX 4
+
+// task may be run from inside another task's driver wait loop (it must not
+// touch the sd card or anything else that can be mid transaction)
+#define TASK_IDLE_SAFE 0x01
+
+typedef PT_THREAD((*task_fn)(__xdata struct pt* pt));
+
+// add a task, returns nonzero if the table is full
+uint8_t task_add(task_fn fn, uint8_t flags);
+
+// give every task one turn, dropping the ones that ended. returns the number
+// of tasks still queued.
+uint8_t task_run(void);
+
+// called by drivers while they busy wait, runs the idle safe tasks other than
+// the one that's currently waiting
+void task_idle(void);
+
+#endif /* TASK_H */
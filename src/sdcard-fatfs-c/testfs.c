@@ -3,83 +3,424 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "cache.h"
+#include "datalog.h"
+#include "diskio.h"
+#include "fpage.h"
 #include "pff.h"
+#include "task.h"
+#include "timebase.h"
+#include "uart.h"
+#include "xmem.h"
 
-struct AM85C30 {
-    uint8_t control_b;
-    uint8_t data_b;
-    uint8_t control_a;
-    uint8_t data_a;
-};
-
-// uart location
-__xdata __at(0x9400) volatile struct AM85C30 uart;
-
-// centisecond count
-volatile uint32_t centiseconds = 0;
-
-// increment centiseconds on timer overflow
-void timer0_overflow_interrupt() __interrupt(TF0_VECTOR) __using(0) {
-    TH0 = 0xdc;
-    centiseconds++;
-}
-
-// setup the timer
-void setup_timer() {
-    TMOD = 0x01;
-    TL0 = 0x00;
-    TH0 = 0xdc;
-    ET0 = 1;
-    TR0 = 1;
-}
-
-// setup the uart for 230400 8N1 (11.0592 MHz PCLK on DUART)
-void setup_uart() {
-    __code const uint8_t init_data[] = {
-        9,  0xC0,
-        4,  0x04,
-        2,  0x00,
-        3,  0xC0,
-        5,  0x60,
-        9,  0x00,
-        10, 0x00,
-        11, 0x56,
-        12, 22,
-        13, 0,
-        14, 0x02,
-        14, 0x03,
-        3,  0xC1,
-        5,  0x68
-    };
+// file streamed to the uart by the benchmark
+#define STREAM_PATH "STREAM.BIN"
+#define STREAM_CHUNK 128
+#define STREAM_FAILED 0xFFFFFFFF
 
+// print a tick count as seconds
+void print_ticks(const __code char* label, uint32_t ticks) {
+    uint16_t hundredths = (uint16_t) (ticks % 100);
+    printf_tiny("%s%u.", label, (uint16_t) (ticks / 100));
+    if (hundredths < 10) {
+        putbyte('0');
+    }
+    printf_tiny("%u s\r\n", hundredths);
+}
+
+// files compared by the multiple file benchmark
+#define COMPARE_A "A.BIN"
+#define COMPARE_B "B.BIN"
+#define COMPARE_CHUNK 64
+
+static uint16_t differences;
+static uint16_t checksum;
+
+void compare_chunks(__xdata uint8_t* a, __xdata uint8_t* b, UINT n) {
+    while (n--) {
+        if (*(a++) != *(b++)) {
+            differences++;
+        }
+    }
+}
+
+// 4 byte reads scattered over the first few fat sectors, the pattern
+// get_fat() produces following fragmented chains. returns cycles taken.
+#define FAT_READS 64
+
+uint32_t fat_reads(__xdata FATFS* fs, uint8_t cached) {
+    __xdata static uint8_t entry[4];
+    uint32_t start = timebase_cycles();
+    DWORD sector;
+    UINT offset;
+    uint8_t i;
+
+    for (i = 0; i != FAT_READS; i++) {
+        sector = fs->fatbase + (i & 3);
+        offset = (UINT) (i * 37) % 128 * 4;
+        if (cached ? cache_readp(entry, sector, offset, 4, CACHE_FAT)
+                : disk_readp(entry, sector, offset, 4)) {
+            return STREAM_FAILED;
+        }
+    }
+    return timebase_cycles() - start;
+}
+
+// sector sized block moves, timed against plain c loops. returns machine
+// cycles per 100 bytes.
+#define BLOCK_SIZE 512
+#define BLOCK_REPEAT 8
+
+static __xdata uint8_t block_a[BLOCK_SIZE];
+static __xdata uint8_t block_b[BLOCK_SIZE];
+
+uint32_t block_cycles(uint8_t op) {
+    __xdata uint8_t* d;
+    __xdata uint8_t* s;
+    uint32_t start = timebase_cycles();
+    uint16_t n;
+    uint8_t i;
+
+    for (i = 0; i != BLOCK_REPEAT; i++) {
+        switch (op) {
+        case 0:
+            d = block_b;
+            s = block_a;
+            for (n = BLOCK_SIZE; n; n--) {
+                *(d++) = *(s++);
+            }
+            break;
+        case 1:
+            xmem_copy(block_b, block_a, BLOCK_SIZE);
+            break;
+        case 2:
+            d = block_b;
+            for (n = BLOCK_SIZE; n; n--) {
+                *(d++) = i;
+            }
+            break;
+        case 3:
+            xmem_fill(block_b, i, BLOCK_SIZE);
+            break;
+        case 4:
+            xmem_cmp(block_a, block_b, BLOCK_SIZE);
+            break;
+        }
+    }
+    return (timebase_cycles() - start) * 100 / ((uint32_t) BLOCK_SIZE * BLOCK_REPEAT);
+}
+
+// repeated opens to average over
+#define OPEN_REPEAT 16
+
+// cycles taken by pf_open(), the first open of a directory builds its index
+uint32_t time_open(const __code char* path) {
+    uint32_t start = timebase_cycles();
+    if (pf_open(path) != FR_OK) {
+        return STREAM_FAILED;
+    }
+    return timebase_cycles() - start;
+}
+
+// average cycles per pf_open() once the directory is cached and indexed
+uint32_t time_opens(const __code char* path) {
+    uint32_t total = 0, cycles;
+    uint8_t i;
+
+    for (i = 0; i != OPEN_REPEAT; i++) {
+        cycles = time_open(path);
+        if (cycles == STREAM_FAILED) {
+            return STREAM_FAILED;
+        }
+        total += cycles;
+    }
+    return total / OPEN_REPEAT;
+}
+
+// compare two files through the single file api, reopening and seeking
+// every time we switch between them. returns the number of sector reads.
+uint32_t compare_reopen(void) {
+    __xdata static uint8_t a[COMPARE_CHUNK];
+    __xdata static uint8_t b[COMPARE_CHUNK];
+    __xdata static UINT br;
+    uint32_t reads = disk_read_count;
+    uint32_t position = 0;
+
+    differences = 0;
+    do {
+        if (pf_open(COMPARE_A) || pf_lseek(position) || pf_read(a, COMPARE_CHUNK, &br)) {
+            return STREAM_FAILED;
+        }
+        if (pf_open(COMPARE_B) || pf_lseek(position) || pf_read(b, br, &br)) {
+            return STREAM_FAILED;
+        }
+        compare_chunks(a, b, br);
+        position += br;
+    } while (br == COMPARE_CHUNK);
+    return disk_read_count - reads;
+}
+
+// compare the same two files with a handle each
+uint32_t compare_handles(void) {
+    __xdata static FIL fa, fb;
+    __xdata static uint8_t a[COMPARE_CHUNK];
+    __xdata static uint8_t b[COMPARE_CHUNK];
+    __xdata static UINT br;
+    uint32_t reads = disk_read_count;
+
+    differences = 0;
+    if (pf_fopen(&fa, COMPARE_A) || pf_fopen(&fb, COMPARE_B)) {
+        return STREAM_FAILED;
+    }
+    do {
+        if (pf_fread(&fa, a, COMPARE_CHUNK, &br) || pf_fread(&fb, b, br, &br)) {
+            return STREAM_FAILED;
+        }
+        compare_chunks(a, b, br);
+    } while (br == COMPARE_CHUNK);
+    return disk_read_count - reads;
+}
+
+// sum the words of a file at a fixed stride through the pager, returns the
+// number of sector reads
+uint32_t paged_scan(uint16_t stride) {
+    __xdata static FIL f;
+    __xdata static FPAGER pager;
+    __xdata static WORD w;
+    uint32_t reads = disk_read_count;
+    DWORD ofs;
+
+    if (pf_fopen(&f, STREAM_PATH) || fpage_open(&pager, &f)) {
+        return STREAM_FAILED;
+    }
+    checksum = 0;
+    for (ofs = 0; ofs + 1 < f.fsize; ofs += stride) {
+        if (fpage_word(&pager, ofs, &w) != FR_OK) {
+            return STREAM_FAILED;
+        }
+        checksum += w;
+    }
+    return disk_read_count - reads;
+}
+
+// file extended by the growth test, it has to exist but may be empty
+#define GROW_PATH "GROW.BIN"
+#define GROW_BYTES 2048
+
+// append to a file, allocating clusters as it goes. returns the card writes
+// it took, including the fat, directory entry and fsinfo updates.
+uint32_t grow_file(void) {
+    __xdata static FIL f;
+    __xdata static uint8_t line[COMPARE_CHUNK];
+    __xdata static UINT bw;
+    uint32_t writes = disk_write_count;
+    UINT i;
+
+    for (i = 0; i != COMPARE_CHUNK - 1; i++) {
+        line[i] = 'a' + i % 26;
+    }
+    line[i] = '\n';
+    if (pf_fopen(&f, GROW_PATH) || pf_flseek(&f, f.fsize)) {
+        return STREAM_FAILED;
+    }
+    for (i = 0; i != GROW_BYTES / COMPARE_CHUNK; i++) {
+        if (pf_fwrite(&f, line, COMPARE_CHUNK, &bw) || bw != COMPARE_CHUNK) {
+            return STREAM_FAILED;
+        }
+    }
+    if (pf_fwrite(&f, 0, 0, &bw)) {
+        return STREAM_FAILED;
+    }
+    print_count(GROW_PATH " is now (bytes): ", f.fsize);
+    return disk_write_count - writes;
+}
+
+// log file for the records per second benchmark, preallocated on first use
+#define LOG_PATH "LOG.BIN"
+#define LOG_SIZE 0x200000
+#define LOG_RECORD 16
+#define LOG_TICKS 500
+
+// append records as fast as the card takes them for a few seconds, returns
+// records per second
+uint32_t log_rate(void) {
+    __xdata static uint8_t record[LOG_RECORD];
+    uint32_t start, elapsed, accepted = 0;
     uint8_t i;
-    for (i = 0; i != sizeof init_data; i++) {
-        uart.control_b = init_data[i];
+
+    if (datalog_open(LOG_PATH, LOG_SIZE) != FR_OK) {
+        return STREAM_FAILED;
+    }
+    task_add(datalog_task, 0);
+    start = timebase_ticks();
+    do {
+        record[0] = (uint8_t) accepted;
+        for (i = 1; i != LOG_RECORD; i++) {
+            record[i] = record[i - 1] + 1;
+        }
+        if (!datalog_append(record, LOG_RECORD)) {
+            accepted++;
+        }
+        task_run();
+        elapsed = timebase_ticks() - start;
+    } while (elapsed < LOG_TICKS);
+    if (datalog_close() != FR_OK) {
+        return STREAM_FAILED;
     }
+    task_run();
+    return accepted * 100 / elapsed;
 }
 
-inline void putbyte(uint8_t b) {
-    uart.data_b = b;
-    while (!(uart.control_b & 0x04));
+// read the file and then send it, one chunk at a time
+uint32_t stream_blocking(void) {
+    __xdata static uint8_t buffer[STREAM_CHUNK];
+    __xdata static UINT br;
+    uint32_t start;
+    UINT i;
+
+    if (pf_open(STREAM_PATH) != FR_OK) {
+        return STREAM_FAILED;
+    }
+    start = timebase_ticks();
+    do {
+        if (pf_read(buffer, STREAM_CHUNK, &br) != FR_OK) {
+            break;
+        }
+        for (i = 0; i != br; i++) {
+            putbyte(buffer[i]);
+        }
+        uart_flush();
+    } while (br == STREAM_CHUNK);
+    return timebase_ticks() - start;
 }
 
-inline uint8_t hasbyte() {
-    return !!(uart.control_b & 0x01);
+// set while a stream task is still filling the uart transmit buffer
+static __bit streaming;
+
+// keeps the transmitter fed until the stream task is done and everything it
+// buffered has gone out
+PT_THREAD(drain_task(__xdata struct pt* pt)) {
+    PT_BEGIN(pt);
+    while (streaming || uart_tx_free() != UART_TX_SIZE) {
+        uart_pump();
+        PT_YIELD(pt);
+    }
+    PT_END(pt);
 }
 
-inline uint8_t getbyte() {
-    while (!hasbyte());
-    return uart.data_b;
+// reads the file straight into the uart transmit buffer as space frees up
+PT_THREAD(stream_task(__xdata struct pt* pt)) {
+    __xdata static UINT br;
+    __xdata uint8_t* p;
+
+    PT_BEGIN(pt);
+    do {
+        PT_WAIT_UNTIL(pt, (p = uart_tx_reserve(STREAM_CHUNK)) != 0);
+        if (pf_read(p, STREAM_CHUNK, &br) != FR_OK) {
+            break;
+        }
+        uart_tx_commit(br);
+    } while (br == STREAM_CHUNK);
+    streaming = 0;
+    PT_END(pt);
+}
+
+// overlap reading with transmission using the scheduler
+uint32_t stream_concurrent(void) {
+    uint32_t start;
+
+    if (pf_open(STREAM_PATH) != FR_OK) {
+        return STREAM_FAILED;
+    }
+    start = timebase_ticks();
+    streaming = 1;
+    task_add(stream_task, 0);
+    task_add(drain_task, TASK_IDLE_SAFE);
+    while (task_run());
+    return timebase_ticks() - start;
 }
 
-int putchar(int c) {
-    putbyte(c);
-    return 0;
+// small reads streamed to the uart, timing only the time spent in pf_read()
+#define SMALL_CHUNK 32
+
+static uint32_t small_cycles;
+
+PT_THREAD(small_task(__xdata struct pt* pt)) {
+    __xdata static UINT br;
+    __xdata uint8_t* p;
+    uint32_t start;
+
+    PT_BEGIN(pt);
+    do {
+        PT_WAIT_UNTIL(pt, (p = uart_tx_reserve(SMALL_CHUNK)) != 0);
+        start = timebase_cycles();
+        if (pf_read(p, SMALL_CHUNK, &br) != FR_OK) {
+            small_cycles = STREAM_FAILED;
+            break;
+        }
+        small_cycles += timebase_cycles() - start;
+        uart_tx_commit(br);
+    } while (br == SMALL_CHUNK);
+    streaming = 0;
+    PT_END(pt);
+}
+
+// reads the next sector ahead whenever the reader is waiting on the uart.
+// it talks to the sd card, so it must not be idle safe.
+PT_THREAD(prefetch_task(__xdata struct pt* pt)) {
+    PT_BEGIN(pt);
+    while (streaming) {
+        pf_prefetch();
+        PT_YIELD(pt);
+    }
+    PT_END(pt);
+}
+
+uint32_t stream_small(uint8_t ahead) {
+    if (pf_open(STREAM_PATH) != FR_OK) {
+        return STREAM_FAILED;
+    }
+    small_cycles = 0;
+    streaming = 1;
+    task_add(small_task, 0);
+    task_add(drain_task, TASK_IDLE_SAFE);
+    if (ahead) {
+        task_add(prefetch_task, 0);
+    }
+    while (task_run());
+    return small_cycles;
+}
+
+// read the whole file in forwarding mode, handing each byte to the sink
+uint32_t stream_forward(DSINK sink) {
+    __xdata static UINT br;
+    uint32_t start;
+
+    if (pf_open(STREAM_PATH) != FR_OK) {
+        return STREAM_FAILED;
+    }
+    disk_set_sink(sink);
+    start = timebase_ticks();
+    do {
+        if (pf_read(0, 0x8000, &br) != FR_OK) {
+            break;
+        }
+    } while (br == 0x8000);
+    start = timebase_ticks() - start;
+    disk_set_sink(0);
+    return start;
+}
+
+void checksum_sink(uint8_t b) {
+    checksum += b;
 }
 
 void main(void) {
-    setup_uart();
-    setup_timer();
+    uint32_t blocking, concurrent, forward, summed, small, ahead;
+    UINT early_stop;
+
+    uart_setup();
+    timebase_setup();
     EA = 1;
 
     // mount SD card
@@ -92,7 +433,79 @@ void main(void) {
     // say we succeeded
     printf_tiny("successfully mounted sd card\r\n");
 
+    // xram block moves
+    print_count("c copy (cycles per 100 bytes): ", block_cycles(0));
+    print_count("xmem copy (cycles per 100 bytes): ", block_cycles(1));
+    print_count("c fill (cycles per 100 bytes): ", block_cycles(2));
+    print_count("xmem fill (cycles per 100 bytes): ", block_cycles(3));
+    print_count("xmem compare (cycles per 100 bytes): ", block_cycles(4));
+
+    // open the same file twice to see the effect of the name index
+    print_count("first open (cycles): ", time_open(STREAM_PATH));
+    print_count("second open (cycles): ", time_open(STREAM_PATH));
+    print_count("average open (cycles): ", time_opens(STREAM_PATH));
+
+    // interleaved reads of two files
+    printf_tiny("file object is %u bytes\r\n", (uint16_t) sizeof (FIL));
+    print_count("compare by reopening (reads): ", compare_reopen());
+    print_count("compare with handles (reads): ", compare_handles());
+    printf_tiny("%u bytes differ\r\n", differences);
+
+    // extend a file
+    print_count("append (writes): ", grow_file());
+
+    // sustained logging
+    print_count("log records per second: ", log_rate());
+    print_count("log buffers written: ", datalog_buffers);
+    print_count("log records refused: ", datalog_dropped);
+
+    // random access through the pager
+    print_count("paged sequential words (reads): ", paged_scan(2));
+    print_count("paged 1000 byte stride (reads): ", paged_scan(1000));
+
+    // stream a file out of the uart, first blocking then overlapped
+    blocking = stream_blocking();
+    concurrent = stream_concurrent();
+    forward = stream_forward(uart_sink);
+    checksum = 0;
+    summed = stream_forward(checksum_sink);
+    small = stream_small(0);
+    ahead = stream_small(1);
+    if (blocking == STREAM_FAILED || concurrent == STREAM_FAILED
+            || forward == STREAM_FAILED || summed == STREAM_FAILED
+            || small == STREAM_FAILED || ahead == STREAM_FAILED) {
+        printf_tiny("\r\nfailed to open " STREAM_PATH "\r\n");
+        goto end;
+    }
+    printf_tiny("\r\n");
+    print_ticks("blocking stream: ", blocking);
+    print_ticks("concurrent stream: ", concurrent);
+    print_ticks("forwarded stream: ", forward);
+    print_ticks("forwarded checksum: ", summed);
+    printf_tiny("checksum = %x\r\n", checksum);
+    print_count("small reads (cycles in pf_read): ", small);
+    print_count("small reads with read ahead (cycles in pf_read): ", ahead);
+
+    // how the sector cache did over everything above
+    print_count("cache hits: ", cache_stats.hits);
+    print_count("cache misses: ", cache_stats.misses);
+    print_count("cache evictions: ", cache_stats.evictions);
+    print_count("cache bypasses: ", cache_stats.bypasses);
+    print_count("card reads: ", disk_read_count);
+
+    // fat lookups read straight from the card, whole sectors against
+    // stopping early, then through a freshly reset cache
+    early_stop = disk_early_stop;
+    disk_early_stop = 0;
+    print_count("fat reads, whole sectors (cycles): ", fat_reads(&fs, 0));
+    disk_early_stop = early_stop;
+    print_count("fat reads, stopped early (cycles): ", fat_reads(&fs, 0));
+    cache_reset();
+    print_count("fat reads, cached (cycles): ", fat_reads(&fs, 1));
+    print_count("reads stopped early: ", disk_stop_count);
+
     // spin forever
 end:
+    uart_flush();
     while (1);
 }
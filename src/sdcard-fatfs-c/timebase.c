@@ -0,0 +1,70 @@
+#include "timebase.h"
+#include "timer.h"
+
+// centisecond count
+volatile uint32_t centiseconds = 0;
+
+// increment centiseconds on timer overflow
+void timebase_isr(void) __interrupt(TF0_VECTOR) __using(0) {
+    // timer 0 keeps counting up from zero after it overflows, so add the
+    // reload to the running count instead of overwriting it. the interrupt
+    // latency is then absorbed rather than accumulating as drift. the low
+    // byte of the reload is zero, so only TH0 needs touching (this is exact
+    // as long as TL0 hasn't wrapped again, i.e. latency < ~250 cycles).
+    TH0 += TIMEBASE_RELOAD >> 8;
+    centiseconds++;
+
+    // count down the software timers
+    TIMER_TICK();
+}
+
+// setup the timer
+void timebase_setup(void) {
+    TMOD = (TMOD & 0xF0) | 0x01;
+    TL0 = TIMEBASE_RELOAD & 0xFF;
+    TH0 = TIMEBASE_RELOAD >> 8;
+    ET0 = 1;
+    TR0 = 1;
+}
+
+uint32_t timebase_ticks(void) {
+    uint32_t ticks;
+
+    // only mask the timer interrupt, other sources keep their latency
+    ET0 = 0;
+    ticks = centiseconds;
+    ET0 = 1;
+    return ticks;
+}
+
+uint32_t timebase_cycles(void) {
+    uint32_t ticks;
+    uint16_t count;
+    uint8_t high, low;
+
+    ET0 = 0;
+
+    // read the running count, retrying if TL0 carried into TH0 in between
+    do {
+        high = TH0;
+        low = TL0;
+    } while (high != TH0);
+    ticks = centiseconds;
+
+    if (TF0) {
+        // an overflow is pending but hasn't been serviced yet. the count we
+        // read may be from either side of it, so read again, it's now the
+        // number of cycles since the overflow (the reload hasn't been added).
+        do {
+            high = TH0;
+            low = TL0;
+        } while (high != TH0);
+        count = ((uint16_t) high << 8) | low;
+        ticks++;
+    } else {
+        count = (((uint16_t) high << 8) | low) - TIMEBASE_RELOAD;
+    }
+
+    ET0 = 1;
+    return ticks * TIMEBASE_CYCLES_PER_TICK + count;
+}
@@ -0,0 +1,31 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <8051.h>
+#include <stdint.h>
+
+// timer 0 counts machine cycles (11.0592 MHz / 12 = 921600 Hz) and is
+// reloaded to overflow every 9216 counts, giving a 100 Hz tick
+#define TIMEBASE_RELOAD 0xDC00
+#define TIMEBASE_CYCLES_PER_TICK 9216
+
+// tick count, incremented on every timer 0 overflow. this is 32 bits wide
+// so reading it from main code is not atomic, use timebase_ticks() instead.
+extern volatile uint32_t centiseconds;
+
+// sdcc requires interrupt handlers to be declared in the file containing
+// main(), so this header must be included there
+void timebase_isr(void) __interrupt(TF0_VECTOR) __using(0);
+
+// start timer 0 and enable its interrupt (EA is left to the caller)
+void timebase_setup(void);
+
+// glitch free snapshot of the tick count
+uint32_t timebase_ticks(void);
+
+// machine cycles (1.085 us) since timebase_setup(), combining the tick count
+// with the live timer 0 count. wraps every ~77 minutes, so only use this for
+// differences.
+uint32_t timebase_cycles(void);
+
+#endif /* TIMEBASE_H */
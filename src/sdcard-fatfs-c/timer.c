@@ -0,0 +1,11 @@
+#include "timer.h"
+
+// remaining ticks per timer, zero when stopped or expired. kept in internal
+// ram so the interrupt can count them down cheaply.
+volatile __data uint16_t timer_remaining[TIMER_COUNT];
+
+// expiry flags, one bit each so polling loops compile to a single jnb
+volatile __bit timer_expired_0;
+volatile __bit timer_expired_1;
+volatile __bit timer_expired_2;
+volatile __bit timer_expired_3;
@@ -0,0 +1,63 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <8051.h>
+#include <stdint.h>
+
+// software timeouts driven by the timebase tick (10 ms). each timer owns a
+// bit that the timer 0 interrupt sets when it runs out, so a polling loop
+// only has to test a single bit instead of doing 32-bit time arithmetic.
+//
+// timer ids must be compile time constants, the macros paste them into the
+// name of the expiry bit.
+
+#define TIMER_SD_BUSY   0   // per transfer waits in the sd driver
+#define TIMER_SD_CMD    1   // sd command retry loops (wrap TIMER_SD_BUSY)
+#define TIMER_UART      2   // uart driver
+#define TIMER_APP       3   // free for the application
+#define TIMER_COUNT     4
+
+extern volatile __data uint16_t timer_remaining[TIMER_COUNT];
+extern volatile __bit timer_expired_0;
+extern volatile __bit timer_expired_1;
+extern volatile __bit timer_expired_2;
+extern volatile __bit timer_expired_3;
+
+#define TIMER_EXPIRED_BIT(n) timer_expired_##n
+
+// start (or restart) timer n, it expires after between ticks - 1 and ticks
+// ticks. arming with zero expires it immediately.
+#define timer_arm(n, ticks) TIMER_ARM_(n, ticks)
+#define TIMER_ARM_(n, ticks) do {                   \
+        ET0 = 0;                                    \
+        timer_remaining[n] = (ticks);               \
+        TIMER_EXPIRED_BIT(n) = !timer_remaining[n]; \
+        ET0 = 1;                                    \
+    } while (0)
+
+// stop timer n without expiring it
+#define timer_stop(n) TIMER_STOP_(n)
+#define TIMER_STOP_(n) do {                         \
+        ET0 = 0;                                    \
+        timer_remaining[n] = 0;                     \
+        TIMER_EXPIRED_BIT(n) = 0;                   \
+        ET0 = 1;                                    \
+    } while (0)
+
+// nonzero once timer n has run out
+#define timer_expired(n) TIMER_EXPIRED_(n)
+#define TIMER_EXPIRED_(n) (TIMER_EXPIRED_BIT(n))
+
+// expanded inside the timebase interrupt on every tick
+#define TIMER_TICK_ONE(n)                           \
+    if (timer_remaining[n] && !--timer_remaining[n]) { \
+        TIMER_EXPIRED_BIT(n) = 1;                   \
+    }
+#define TIMER_TICK() do {                           \
+        TIMER_TICK_ONE(0)                           \
+        TIMER_TICK_ONE(1)                           \
+        TIMER_TICK_ONE(2)                           \
+        TIMER_TICK_ONE(3)                           \
+    } while (0)
+
+#endif /* TIMER_H */
@@ -0,0 +1,134 @@
+#include "uart.h"
+
+#define UART_RR0_RX_AVAILABLE 0x01
+#define UART_RR0_TX_EMPTY 0x04
+
+#define UART_TX_MASK (UART_TX_SIZE - 1)
+
+// uart location
+__xdata __at(0x9400) volatile struct AM85C30 uart;
+
+// transmit ring buffer. only touched from main code, so no locking needed.
+static __xdata uint8_t uart_tx_buffer[UART_TX_SIZE];
+static uint16_t uart_tx_head;
+static uint16_t uart_tx_tail;
+static uint16_t uart_tx_count;
+
+void uart_setup(void) {
+    __code const uint8_t init_data[] = {
+        9,  0xC0,
+        4,  0x04,
+        2,  0x00,
+        3,  0xC0,
+        5,  0x60,
+        9,  0x00,
+        10, 0x00,
+        11, 0x56,
+        12, 22,
+        13, 0,
+        14, 0x02,
+        14, 0x03,
+        3,  0xC1,
+        5,  0x68
+    };
+
+    uint8_t i;
+    for (i = 0; i != sizeof init_data; i++) {
+        uart.control_b = init_data[i];
+    }
+}
+
+void uart_pump(void) {
+    while (uart_tx_count && (uart.control_b & UART_RR0_TX_EMPTY)) { // @loop
+        uart.data_b = uart_tx_buffer[uart_tx_tail];
+        uart_tx_tail = (uart_tx_tail + 1) & UART_TX_MASK;
+        uart_tx_count--;
+    }
+}
+
+void uart_flush(void) {
+    while (uart_tx_count) {
+        uart_pump();
+    }
+}
+
+uint16_t uart_tx_free(void) {
+    return UART_TX_SIZE - uart_tx_count;
+}
+
+__xdata uint8_t* uart_tx_reserve(uint16_t n) {
+    // once the ring has drained start over at the front, so a head left
+    // off a chunk boundary by putbyte() can't strand the reservation at
+    // the end for good
+    if (!uart_tx_count) {
+        uart_tx_head = 0;
+        uart_tx_tail = 0;
+    }
+    if (n > UART_TX_SIZE - uart_tx_head || n > UART_TX_SIZE - uart_tx_count) {
+        return 0;
+    }
+    return &uart_tx_buffer[uart_tx_head];
+}
+
+void uart_tx_commit(uint16_t n) {
+    uart_tx_head = (uart_tx_head + n) & UART_TX_MASK;
+    uart_tx_count += n;
+}
+
+void putbyte(uint8_t b) {
+    while (uart_tx_count == UART_TX_SIZE) {
+        uart_pump();
+    }
+    uart_tx_buffer[uart_tx_head] = b;
+    uart_tx_head = (uart_tx_head + 1) & UART_TX_MASK;
+    uart_tx_count++;
+    uart_pump();
+}
+
+void print_count(const __code char* label, uint32_t n) {
+    __xdata static char digits[11];
+    uint8_t i = sizeof digits - 1;
+
+    digits[i] = 0;
+    do {
+        digits[--i] = '0' + (uint8_t) (n % 10);
+        n /= 10;
+    } while (n);
+    while (*label) {
+        putbyte(*(label++));
+    }
+    while (digits[i]) {
+        putbyte(digits[i++]);
+    }
+    putbyte('\r');
+    putbyte('\n');
+}
+
+void uart_sink(uint8_t b) {
+    while (!(uart.control_b & UART_RR0_TX_EMPTY));
+    uart.data_b = b;
+}
+
+uint8_t hasbyte(void) {
+    return !!(uart.control_b & UART_RR0_RX_AVAILABLE);
+}
+
+uint8_t getbyte(void) {
+    while (!hasbyte());
+    return uart.data_b;
+}
+
+int putchar(int c) {
+    putbyte(c);
+    return 0;
+}
+
+PT_THREAD(uart_task(__xdata struct pt* pt)) {
+    PT_BEGIN(pt);
+    while (1) {
+        PT_WAIT_UNTIL(pt, uart_tx_count);
+        uart_pump();
+        PT_YIELD(pt);
+    }
+    PT_END(pt);
+}
@@ -0,0 +1,58 @@
+#ifndef UART_H
+#define UART_H
+
+#include <stdint.h>
+
+#include "pt.h"
+
+struct AM85C30 {
+    uint8_t control_b;
+    uint8_t data_b;
+    uint8_t control_a;
+    uint8_t data_a;
+};
+
+// uart location
+extern __xdata volatile struct AM85C30 uart;
+
+// transmit ring buffer size, must be a power of two
+#define UART_TX_SIZE 1024
+
+// setup the uart for 230400 8N1 (11.0592 MHz PCLK on DUART)
+void uart_setup(void);
+
+// move buffered bytes into the transmitter for as long as it has room,
+// never blocks
+void uart_pump(void);
+
+// pump until everything buffered has been handed to the transmitter
+void uart_flush(void);
+
+// number of free bytes in the transmit buffer
+uint16_t uart_tx_free(void);
+
+// contiguous space for n bytes at the head of the transmit buffer, or 0 if
+// there isn't enough. fill it and then uart_tx_commit() what was written.
+// when the head is too close to the end of the buffer this keeps returning
+// 0 until everything buffered has gone out, then starts at the front.
+__xdata uint8_t* uart_tx_reserve(uint16_t n);
+void uart_tx_commit(uint16_t n);
+
+// buffered byte output, pumps while the buffer is full
+void putbyte(uint8_t b);
+
+// label, a 32 bit count in decimal and a line break, printf_tiny can't
+// print 32 bit numbers
+void print_count(const __code char* label, uint32_t n);
+
+// unbuffered output for forwarded disk reads, flush the buffer before
+// switching to it to keep the output in order
+void uart_sink(uint8_t b);
+
+uint8_t hasbyte(void);
+uint8_t getbyte(void);
+
+// idle safe task that keeps the transmitter fed
+PT_THREAD(uart_task(__xdata struct pt* pt));
+
+#endif /* UART_H */
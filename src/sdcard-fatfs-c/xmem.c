@@ -0,0 +1,140 @@
+#include <8051.h>
+
+#include "xmem.h"
+
+// the assembly takes its parameters from the data segment, which is where
+// the small model puts them for non-reentrant functions. other models and
+// --stack-auto pass them elsewhere and get the plain c loops.
+#if defined(__SDCC_MODEL_SMALL) && !defined(__SDCC_STACK_AUTO)
+
+// the count is split into r6 (low) and r7 (high) for a double djnz loop.
+// the low byte runs out first, so r7 is bumped when it is non-zero to count
+// the partial page. a count of 0x0200 runs 2 x 256, 0x0105 runs 5 + 256.
+
+// 11 machine cycles per byte
+void xmem_copy(__xdata void* dst, const __xdata void* src, uint16_t n) __naked {
+    dst; src; n;
+    __asm
+        mov     a, _xmem_copy_PARM_3
+        mov     r6, a
+        orl     a, (_xmem_copy_PARM_3 + 1)
+        jz      00004$
+        mov     r7, (_xmem_copy_PARM_3 + 1)
+        mov     a, r6
+        jz      00001$
+        inc     r7
+00001$:
+        push    _P2
+        mov     r0, _xmem_copy_PARM_2
+        mov     _P2, (_xmem_copy_PARM_2 + 1)
+00002$:
+        movx    a, @r0
+        movx    @dptr, a
+        inc     dptr
+        inc     r0
+        cjne    r0, #0, 00003$
+        inc     _P2
+00003$:
+        djnz    r6, 00002$
+        djnz    r7, 00002$
+        pop     _P2
+00004$:
+        ret
+    __endasm;
+}
+
+// 6 machine cycles per byte
+void xmem_fill(__xdata void* dst, uint8_t val, uint16_t n) __naked {
+    dst; val; n;
+    __asm
+        mov     a, _xmem_fill_PARM_3
+        mov     r6, a
+        orl     a, (_xmem_fill_PARM_3 + 1)
+        jz      00003$
+        mov     r7, (_xmem_fill_PARM_3 + 1)
+        mov     a, r6
+        jz      00001$
+        inc     r7
+00001$:
+        mov     a, _xmem_fill_PARM_2
+00002$:
+        movx    @dptr, a
+        inc     dptr
+        djnz    r6, 00002$
+        djnz    r7, 00002$
+00003$:
+        ret
+    __endasm;
+}
+
+// 14 machine cycles per equal byte
+uint8_t xmem_cmp(const __xdata void* a, const __xdata void* b, uint16_t n) __naked {
+    a; b; n;
+    __asm
+        mov     a, _xmem_cmp_PARM_3
+        mov     r6, a
+        orl     a, (_xmem_cmp_PARM_3 + 1)
+        jz      00005$
+        mov     r7, (_xmem_cmp_PARM_3 + 1)
+        mov     a, r6
+        jz      00001$
+        inc     r7
+00001$:
+        push    _P2
+        mov     r0, _xmem_cmp_PARM_2
+        mov     _P2, (_xmem_cmp_PARM_2 + 1)
+00002$:
+        movx    a, @r0
+        mov     b, a
+        movx    a, @dptr
+        cjne    a, b, 00004$
+        inc     dptr
+        inc     r0
+        cjne    r0, #0, 00003$
+        inc     _P2
+00003$:
+        djnz    r6, 00002$
+        djnz    r7, 00002$
+        pop     _P2
+00005$:
+        mov     dpl, #0
+        ret
+00004$:
+        pop     _P2
+        mov     dpl, #1
+        ret
+    __endasm;
+}
+
+#else
+
+void xmem_copy(__xdata void* dst, const __xdata void* src, uint16_t n) {
+    __xdata uint8_t* d = dst;
+    const __xdata uint8_t* s = src;
+
+    while (n--) {
+        *(d++) = *(s++);
+    }
+}
+
+void xmem_fill(__xdata void* dst, uint8_t val, uint16_t n) {
+    __xdata uint8_t* d = dst;
+
+    while (n--) {
+        *(d++) = val;
+    }
+}
+
+uint8_t xmem_cmp(const __xdata void* a, const __xdata void* b, uint16_t n) {
+    const __xdata uint8_t* p = a;
+    const __xdata uint8_t* q = b;
+
+    while (n--) {
+        if (*(p++) != *(q++)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif
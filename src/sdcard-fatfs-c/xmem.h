@@ -0,0 +1,21 @@
+#ifndef XMEM_H
+#define XMEM_H
+
+#include <stdint.h>
+
+// block copy, fill and compare within xram. the p80c550 has a single dptr,
+// so the copy and compare walk one side with dptr and the other with
+// movx @r0, using p2 as the high address byte. an interrupt taken inside
+// their loops finds p2 pointing at some page of the block instead of the
+// pdata page, so interrupt handlers must not use pdata or movx @r0/@r1
+// unless they load p2 themselves and put it back before returning.
+//
+// counts are 16 bit and 0 is a no-op. regions may not overlap.
+
+void xmem_copy(__xdata void* dst, const __xdata void* src, uint16_t n);
+void xmem_fill(__xdata void* dst, uint8_t val, uint16_t n);
+
+// 0 if the blocks are equal, 1 otherwise
+uint8_t xmem_cmp(const __xdata void* a, const __xdata void* b, uint16_t n);
+
+#endif /* XMEM_H */
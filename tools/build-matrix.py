@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Build the SD card projects under each SDCC memory model and placement
+option and report sizes and simulated cycle counts.
+
+Every configuration is built with `make MODEL=... STACK_AUTO=... PDATA=...
+NOREENT=...` in src/sdcard-c and src/sdcard-fatfs-c. PDATA and NOREENT
+only exist in sdcard-fatfs-c, so sdcard-c is built under the memory models
+alone. Code, XRAM, pdata and IRAM use come from the linker's .mem file, and
+images bigger than the 32 KiB AT28C256 are flagged. Compiler warnings are
+counted and printed.
+
+Each project's benchmark image is then run in the ucsim s51 simulator and
+the cycles it prints for each phase are added to the table: simbench (the
+FAT paths against the simulated disk in diskio_sim.c) for sdcard-fatfs-c
+and sdcard-sim (sdcard.c's card init and 64 KiB read against a simulated
+card) for sdcard-c. Both read 64 KiB in 512 byte pieces as "read-512".
+
+    tools/build-matrix.py [--cc /opt/sdcc-4.1.6/bin/sdcc] [--sim s51] [--out table.md]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+
+import sdccout
+import ucsim
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# (label, MODEL, STACK_AUTO, PDATA, NOREENT). NOREENT=1 needs the large
+# model without --stack-auto, see src/sdcard-fatfs-c/Makefile.
+CONFIGS = [
+    ("small", "small", 0, 0, ""),
+    ("medium", "medium", 0, 0, ""),
+    ("large", "large", 0, 0, ""),
+    ("small --stack-auto", "small", 1, 0, ""),
+    ("medium --stack-auto", "medium", 1, 0, ""),
+    ("large --stack-auto", "large", 1, 0, ""),
+    ("small PDATA=1", "small", 0, 1, ""),
+    ("medium PDATA=1", "medium", 0, 1, ""),
+    ("large PDATA=1", "large", 0, 1, ""),
+    ("small NOREENT=sd", "small", 0, 0, "sd"),
+    ("small PDATA=1 NOREENT=sd", "small", 0, 1, "sd"),
+    ("large NOREENT=1", "large", 0, 0, "1"),
+    ("large PDATA=1 NOREENT=1", "large", 0, 1, "1"),
+]
+
+# project directory, image to measure, image to simulate, whether the
+# Makefile takes PDATA and NOREENT
+PROJECTS = [
+    ("src/sdcard-c", "sdcard", "sdcard-sim", False),
+    ("src/sdcard-fatfs-c", "testfs", "simbench", True),
+]
+
+# AT28C256
+ROM_SIZE = 32768
+
+
+def make(directory, cc, config, *targets):
+    label, model, stack_auto, pdata, noreent = config
+    args = ["make", "-C", os.path.join(ROOT, directory),
+            "MODEL=" + model, "STACK_AUTO=%d" % stack_auto,
+            "PDATA=%d" % pdata, "NOREENT=" + noreent]
+    if cc:
+        args.append("CC=" + cc)
+    args.extend(targets)
+    result = subprocess.run(args, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, universal_newlines=True)
+    return result.returncode == 0, result.stdout
+
+
+def warnings(log):
+    """Compiler and linker warnings in a build log."""
+    return [line for line in log.splitlines() if "warning" in line.lower()]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--cc", help="sdcc to build with (default: the Makefiles' CC)")
+    parser.add_argument("--sim", default="s51", help="ucsim 8051 simulator")
+    parser.add_argument("--timeout", type=float, default=600,
+                        help="seconds to let each simulation run")
+    parser.add_argument("--no-sim", action="store_true", help="only report sizes")
+    parser.add_argument("--out", help="also write the table to this file")
+    args = parser.parse_args()
+
+    rows = []
+    phase_names = []
+    for directory, image, sim_image, placement in PROJECTS:
+        for config in CONFIGS:
+            label, model, stack_auto, pdata, noreent = config
+            if not placement and (pdata or noreent):
+                continue
+            row = {"project": os.path.basename(directory), "config": label}
+            rows.append(row)
+            print("building %s (%s)" % (directory, label), file=sys.stderr)
+
+            make(directory, args.cc, config, "clean")
+            ok, log = make(directory, args.cc, config, image + ".ihx", sim_image + ".ihx")
+            found = warnings(log)
+            row["warnings"] = len(found)
+            for line in found:
+                print(line, file=sys.stderr)
+            if not ok:
+                row["status"] = "build failed"
+                print(log, file=sys.stderr)
+                continue
+            mem = sdccout.read_mem(os.path.join(ROOT, directory, image + ".mem"))
+            for name in ("code", "xram", "pdata"):
+                if name in mem:
+                    row[name] = mem[name][0]
+            row["iram"] = mem.get("iram", "")
+            row["status"] = "ok"
+            if "code" in mem and mem["code"][0] > ROM_SIZE:
+                row["status"] = "over ROM"
+
+            if not args.no_sim:
+                phases = ucsim.run(args.sim, os.path.join(ROOT, directory, sim_image + ".ihx"),
+                                   args.timeout)
+                if phases.get("errors"):
+                    row["status"] = "read errors"
+                elif not phases:
+                    row["status"] = "no sim output"
+                for name, cycles in phases.items():
+                    if name not in phase_names:
+                        phase_names.append(name)
+                    row[name] = cycles
+        make(directory, args.cc, CONFIGS[0], "clean")
+
+    columns = ["project", "config", "status", "warnings", "code", "xram", "pdata", "iram"] + phase_names
+    lines = ["| " + " | ".join(columns) + " |", "|" + "---|" * len(columns)]
+    for row in rows:
+        lines.append("| " + " | ".join(str(row.get(c, "")) for c in columns) + " |")
+    print("\n".join(lines))
+    if args.out:
+        with open(args.out, "w") as f:
+            f.write("\n".join(lines) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+"""Static machine cycle counts for functions and loops in SDCC listings.
+
+Reads the .rst (or .lst) listing of a module, splits every function into
+basic blocks and prints, per function,
+
+  * each loop with the cycles one iteration takes, shortest and longest
+    path through its body, and the C line it belongs to
+  * for leaf functions (no calls), the cycles one call takes from entry to
+    return, not counting loop iterations beyond the first
+  * with --blocks, every basic block with its cycle count
+
+A loop is marked by putting @loop in a comment on its C line, SDCC copies
+the line into the listing. --marked only reports those loops.
+
+Counts are 8051 machine cycles (12 oscillator periods, 1.085 us at
+11.0592 MHz). On the 8051 a conditional branch takes as long whether it is
+taken or not, so a path's cost is exact. Inner loops are counted as one
+pass through their body.
+
+    tools/cycles.py src/sdcard-fatfs-c/diskio.rst [--function disk_readp] [--blocks]
+"""
+
+import argparse
+import fnmatch
+import re
+import sys
+
+import sdccout
+
+# machine cycles by opcode, everything not listed takes one
+_TWO = [0x02, 0x10, 0x12, 0x20, 0x22, 0x30, 0x32, 0x40, 0x43, 0x50, 0x53, 0x60, 0x63,
+        0x70, 0x72, 0x73, 0x75, 0x80, 0x82, 0x83, 0x85, 0x86, 0x87, 0x90, 0x92, 0x93,
+        0xA0, 0xA3, 0xA6, 0xA7, 0xB0, 0xC0, 0xD0, 0xD5, 0xE0, 0xE2, 0xE3, 0xF0, 0xF2, 0xF3]
+_TWO += list(range(0x01, 0x100, 0x10)) + list(range(0x11, 0x100, 0x10))  # ajmp, acall
+_TWO += list(range(0x88, 0x90)) + list(range(0xA8, 0xB0))                  # mov dir,rn / rn,dir
+_TWO += list(range(0xB4, 0xC0)) + list(range(0xD8, 0xE0))                  # cjne, djnz rn
+CYCLES = [1] * 256
+for op in _TWO:
+    CYCLES[op] = 2
+CYCLES[0x84] = CYCLES[0xA4] = 4   # div, mul
+
+JUMPS = {"sjmp", "ljmp", "ajmp", "jmp"}
+BRANCHES = {"jz", "jnz", "jc", "jnc", "jb", "jnb", "jbc", "cjne", "djnz"}
+CALLS = {"lcall", "acall"}
+RETURNS = {"ret", "reti"}
+SOURCE = re.compile(r";\s+(\S+\.c):(\d+):\s?(.*)$")
+
+
+class Block:
+    def __init__(self, label, address, source):
+        self.label = label
+        self.labels = [label]
+        self.address = address
+        self.source = source
+        self.cycles = 0
+        self.instructions = 0
+        self.targets = []       # labels jumped to
+        self.falls = True       # continues into the next block
+        self.exits = False      # returns
+        self.calls = False
+
+
+def split(lines):
+    """Basic blocks of each function, {name: [Block]} in address order."""
+    result = {}
+    blocks = None
+    block = None
+    function = None
+    source = None
+    for entry in lines:
+        m = SOURCE.search(entry["text"])
+        if m and not entry["bytes"]:
+            source = "%s:%s: %s" % m.groups()
+            continue
+        if entry["area"] != "CSEG" or entry["address"] is None:
+            continue
+        if entry["function"] != function:
+            function = entry["function"]
+            blocks = result.setdefault(function, [])
+            block = None
+        if entry["label"]:
+            if block is None or block.instructions:
+                block = Block(entry["label"], entry["address"], source)
+                blocks.append(block)
+            else:
+                block.labels.append(entry["label"])
+            continue
+        text = entry["text"].strip()
+        if not entry["bytes"] or text.startswith("."):
+            continue
+        if block is None:
+            block = Block("%04X" % entry["address"], entry["address"], source)
+            blocks.append(block)
+
+        fields = text.split(None, 1)
+        mnemonic = fields[0].lower()
+        operands = fields[1].split(";")[0] if len(fields) > 1 else ""
+        block.cycles += CYCLES[entry["bytes"][0]]
+        block.instructions += 1
+        if mnemonic in CALLS:
+            block.calls = True
+        ended = False
+        if mnemonic in JUMPS:
+            if "@" not in operands:
+                block.targets.append(operands.split(",")[-1].strip())
+            else:
+                block.exits = True     # jump table, the cases aren't followed
+            block.falls = False
+            ended = True
+        elif mnemonic in BRANCHES:
+            block.targets.append(operands.split(",")[-1].strip())
+            ended = True
+        elif mnemonic in RETURNS:
+            block.exits = True
+            block.falls = False
+            ended = True
+        if ended:
+            block = None
+    for blocks in result.values():
+        for i, b in enumerate(blocks):
+            b.next = blocks[i + 1] if i + 1 < len(blocks) else None
+    return result
+
+
+def successors(block, by_label):
+    out = [by_label[t] for t in block.targets if t in by_label]
+    if block.falls and block.next:
+        out.append(block.next)
+    return out
+
+
+def paths(start, blocks, by_label, end=None):
+    """Shortest and longest cycles from start to end (or to any return)
+    following forward edges only."""
+    inf = float("inf")
+    order = [b for b in blocks if b.address >= start.address]
+    best = {id(start): (start.cycles, start.cycles)}
+    result = None
+    for b in order:
+        if id(b) not in best:
+            continue
+        lo, hi = best[id(b)]
+        if (end is b) or (end is None and b.exits):
+            result = (min(lo, result[0]), max(hi, result[1])) if result else (lo, hi)
+            if end is b:
+                continue
+        for s in successors(b, by_label):
+            if s.address <= b.address or (end and s.address > end.address):
+                continue
+            cur = best.get(id(s), (inf, -inf))
+            best[id(s)] = (min(cur[0], lo + s.cycles), max(cur[1], hi + s.cycles))
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("listings", nargs="+", help=".rst or .lst files")
+    parser.add_argument("--function", action="append", help="only these functions (wildcards allowed)")
+    parser.add_argument("--blocks", action="store_true", help="print every basic block")
+    parser.add_argument("--marked", action="store_true", help="only loops marked @loop")
+    args = parser.parse_args()
+
+    for listing in args.listings:
+        for name, blocks in split(sdccout.read_rst(listing)).items():
+            if not name or not blocks:
+                continue
+            if args.function and not any(fnmatch.fnmatch(name, f) for f in args.function):
+                continue
+            by_label = {label: b for b in blocks for label in b.labels}
+            loops = []
+            for b in blocks:
+                for s in successors(b, by_label):
+                    if s.address <= b.address:
+                        loops.append((s, b))
+            if args.marked:
+                loops = [l for l in loops if l[0].source and "@loop" in l[0].source]
+                if not loops:
+                    continue
+
+            leaf = not any(b.calls for b in blocks)
+            print("%s (%s)" % (name, listing))
+            if leaf:
+                cost = paths(blocks[0], blocks, by_label)
+                if cost:
+                    print("  per call: %d..%d cycles%s"
+                          % (cost[0], cost[1], " + loop iterations" if loops else ""))
+            for head, tail in loops:
+                cost = paths(head, blocks, by_label, tail)
+                if cost:
+                    print("  loop at %s: %d..%d cycles per iteration" % (head.label, cost[0], cost[1]))
+                    if head.source:
+                        print("    " + head.source)
+            if args.blocks:
+                for b in blocks:
+                    print("  %04X %-10s %3d cycles %2d instructions%s"
+                          % (b.address, b.label, b.cycles, b.instructions,
+                             "  " + b.source if b.source else ""))
+            print()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
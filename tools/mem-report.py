@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Report code and RAM use of the SDCC builds under src/ and check them
+against budgets.
+
+For every linked image (a .mem next to a .map) in the project directories
+this prints ROM, XRAM, pdata, IRAM and stack use with the headroom left,
+the code bytes of each module and, with --functions, of each function.
+Module and function sizes come from the .rst listings of the modules the
+.map says were linked. A function's size is the code from its label to the
+next function of the module; constant tables are counted in the module
+total only.
+
+Budgets are read from tools/mem-budget.json. "default" applies to every
+image and "<project>/<image>" entries override it, e.g.
+
+    {"default": {"code": 32768, "iram": 128, "stack": 16},
+     "src/sdcard-fatfs-c/testfs": {"xram": 30000}}
+
+code, xram, pdata and iram are upper limits in bytes, stack is the least
+stack space that must be left. With --check the exit status is 1 when any
+image is over budget.
+
+    tools/mem-report.py [--build] [--functions] [--check] [project ...]
+"""
+
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+
+import sdccout
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BUDGETS = os.path.join(ROOT, "tools", "mem-budget.json")
+
+
+def projects(args):
+    if args:
+        return [os.path.relpath(os.path.abspath(p), ROOT) for p in args]
+    return sorted(os.path.relpath(os.path.dirname(p), ROOT)
+                  for p in glob.glob(os.path.join(ROOT, "src", "*", "Makefile")))
+
+
+def module_sizes(directory, modules):
+    """ROM bytes per module and code bytes per function from the .rst
+    listings of the modules linked into an image."""
+    sizes = {}
+    for module in modules:
+        try:
+            lines = sdccout.read_rst(os.path.join(directory, module + ".rst"))
+        except OSError:
+            continue
+        sizes[module] = (sdccout.rom_bytes(lines), sdccout.functions(lines))
+    return sizes
+
+
+def load_budgets():
+    try:
+        with open(BUDGETS) as f:
+            return json.load(f)
+    except OSError:
+        return {}
+
+
+def check(image, mem, budgets):
+    budget = dict(budgets.get("default", {}))
+    budget.update(budgets.get(image, {}))
+    failures = []
+    for name in ("code", "xram", "pdata"):
+        if name in budget and name in mem and mem[name][0] > budget[name]:
+            failures.append("%s %d > %d" % (name, mem[name][0], budget[name]))
+    if "iram" in budget and "iram" in mem and mem["iram"] > budget["iram"]:
+        failures.append("iram %d > %d" % (mem["iram"], budget["iram"]))
+    if "stack" in budget and "stack" in mem and mem["stack"] < budget["stack"]:
+        failures.append("stack %d < %d" % (mem["stack"], budget["stack"]))
+    return budget, failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("projects", nargs="*", help="project directories (default: src/*)")
+    parser.add_argument("--build", action="store_true", help="run make in each project first")
+    parser.add_argument("--functions", action="store_true", help="list every function")
+    parser.add_argument("--check", action="store_true", help="exit 1 when over budget")
+    args = parser.parse_args()
+
+    budgets = load_budgets()
+    over = []
+    for project in projects(args.projects):
+        directory = os.path.join(ROOT, project)
+        if args.build:
+            subprocess.run(["make", "-C", directory], stdout=subprocess.DEVNULL)
+        for mem_path in sorted(glob.glob(os.path.join(directory, "*.mem"))):
+            name = os.path.splitext(os.path.basename(mem_path))[0]
+            if not os.path.exists(os.path.join(directory, name + ".map")):
+                continue
+            image = project + "/" + name
+            mem = sdccout.read_mem(mem_path)
+            budget, failures = check(image, mem, budgets)
+
+            print(image)
+            for key in ("code", "xram", "pdata"):
+                if key in mem:
+                    used, limit = mem[key]
+                    limit = budget.get(key, limit)
+                    print("  %-6s %6d / %6d bytes, %6d free" % (key, used, limit, limit - used))
+            if "iram" in mem:
+                limit = budget.get("iram", 128)
+                print("  %-6s %6d / %6d bytes, %6d free for the stack"
+                      % ("iram", mem["iram"], limit, mem["stack"]))
+
+            areas, linked = sdccout.read_map(os.path.join(directory, name + ".map"))
+            modules = module_sizes(directory, linked)
+            for module, (rom, funcs) in sorted(modules.items(), key=lambda m: -m[1][0]):
+                print("  %-24s %6d" % (module, rom))
+                if args.functions:
+                    for func, size in sorted(funcs.items(), key=lambda f: -f[1]):
+                        print("    %-22s %6d" % (func, size))
+
+            for failure in failures:
+                print("  OVER BUDGET: " + failure)
+            if failures:
+                over.append(image)
+            print()
+
+    if args.check and over:
+        print("over budget: " + ", ".join(over), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,414 @@
+#!/usr/bin/env python3
+"""Generate FAT12, FAT16 and FAT32 test volumes with a controlled layout.
+
+The image is written sparse, so large volumes only cost the space of their
+metadata and file data. A JSON manifest records the geometry and, for every
+file and directory, its clusters and the expected contents, so a test can
+check what Petit FatFs reads.
+
+Files are given as PATH:SIZE[:LAYOUT]. Directories in the path are created
+on the way. LAYOUT is how the file's clusters are allocated:
+
+    contiguous  the next free clusters in order (default)
+    reverse     the next free clusters, chained from the last to the first
+    stride:N    every Nth cluster, leaving gaps that later files fill
+    interleave  one cluster at a time in turn with the other interleave
+                files, so their chains alternate
+    random:SEED clusters picked from the free space with a seeded shuffle
+
+Byte i of the file with seed s (its position in the manifest, from 1) is
+(i ^ (i >> 8) ^ s) & 0xFF, so firmware can check reads without a copy.
+
+--dir PATH:N makes a directory holding N empty files, to grow directories
+over several clusters (or fill the FAT12/16 root).
+
+    tools/mkfatimg.py card.img --fat 16 --size 64M --cluster 2048 --mbr \\
+        --file STREAM.BIN:65536 --file LOGS/A.BIN:700:stride:3 \\
+        --dir MANY:300 --manifest card.json
+"""
+
+import argparse
+import json
+import random
+import struct
+import sys
+import zlib
+
+SECTOR = 512
+# cluster count limits that decide the FAT type, as FatFs determines it
+FAT12_MAX = 4084
+FAT16_MAX = 65524
+EOC = {12: 0xFFF, 16: 0xFFFF, 32: 0x0FFFFFFF}
+PARTITION_TYPE = {12: 0x01, 16: 0x06, 32: 0x0C}
+# 2024-01-01 00:00:00, so images are reproducible
+FAT_DATE = (2024 - 1980) << 9 | 1 << 5 | 1
+FAT_TIME = 0
+
+
+def size_arg(text):
+    units = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30}
+    if text[-1].upper() in units:
+        return int(text[:-1]) * units[text[-1].upper()]
+    return int(text)
+
+
+def short_name(name):
+    """8.3 directory entry name, 11 bytes."""
+    base, _, ext = name.upper().partition(".")
+    if not base or len(base) > 8 or len(ext) > 3:
+        raise ValueError("not an 8.3 name: " + name)
+    for c in base + ext:
+        if not (c.isalnum() or c in "$%'-_@~`!(){}^#&") or ord(c) > 127:
+            raise ValueError("invalid character in " + name)
+    return (base.ljust(8) + ext.ljust(3)).encode("ascii")
+
+
+def pattern(size, seed):
+    data = bytearray(size)
+    for i in range(size):
+        data[i] = (i ^ (i >> 8) ^ seed) & 0xFF
+    return bytes(data)
+
+
+class Node:
+    def __init__(self, name, is_dir, size=0, layout="contiguous"):
+        self.name = name
+        self.is_dir = is_dir
+        self.size = size
+        self.layout = layout
+        self.children = []
+        self.clusters = []
+        self.seed = 0
+        self.path = name
+
+    def child(self, name):
+        for c in self.children:
+            if c.name == name:
+                return c
+        return None
+
+
+class Volume:
+    def __init__(self, fat, size, cluster, root_entries, reserved, fats, start):
+        self.fat = fat
+        self.start = start                  # partition start sector
+        self.sectors = size // SECTOR - start
+        self.spc = cluster // SECTOR
+        if self.spc not in (1, 2, 4, 8, 16, 32, 64, 128) or cluster % SECTOR:
+            raise ValueError("cluster size must be 512 bytes times a power of two up to 64 KiB")
+        self.fats = fats
+        self.reserved = reserved if reserved else (32 if fat == 32 else 1)
+        self.root_entries = 0 if fat == 32 else root_entries
+        self.root_sectors = (self.root_entries * 32 + SECTOR - 1) // SECTOR
+
+        # the fat has to cover the clusters left after it, iterate to a fixed point
+        self.fat_sectors = 1
+        while True:
+            clusters = (self.sectors - self.reserved - self.root_sectors
+                        - self.fats * self.fat_sectors) // self.spc
+            need = ((clusters + 2) * fat + 7) // 8
+            need = (need + SECTOR - 1) // SECTOR
+            if need <= self.fat_sectors:
+                break
+            self.fat_sectors = need
+        self.clusters = clusters
+        low, high = {12: (1, FAT12_MAX), 16: (FAT12_MAX + 1, FAT16_MAX),
+                     32: (FAT16_MAX + 1, 0x0FFFFFF5)}[fat]
+        if not low <= clusters <= high:
+            raise ValueError("%d clusters is not a FAT%d volume, change --size or --cluster"
+                             % (clusters, fat))
+
+        self.fat_base = self.reserved
+        self.root_base = self.fat_base + self.fats * self.fat_sectors
+        self.data_base = self.root_base + self.root_sectors
+        self.table = [0] * (clusters + 2)
+        self.table[0] = EOC[fat] & ~0xFF | 0xF8
+        self.table[1] = EOC[fat]
+        self.free = list(range(2, clusters + 2))
+
+    def cluster_sector(self, clust):
+        return self.data_base + (clust - 2) * self.spc
+
+    def take(self, clusters):
+        taken = set(clusters)
+        self.free = [c for c in self.free if c not in taken]
+
+    def chain(self, clusters):
+        for a, b in zip(clusters, clusters[1:]):
+            self.table[a] = b
+        if clusters:
+            self.table[clusters[-1]] = EOC[self.fat]
+
+    def allocate(self, count, layout):
+        if count > len(self.free):
+            raise ValueError("volume full")
+        kind, _, arg = layout.partition(":")
+        if kind == "contiguous":
+            clusters = self.free[:count]
+        elif kind == "reverse":
+            clusters = self.free[:count][::-1]
+        elif kind == "stride":
+            step = int(arg or 2)
+            free = set(self.free)
+            clusters = []
+            c = self.free[0]
+            while len(clusters) < count:
+                if c >= self.clusters + 2:
+                    raise ValueError("stride runs off the end of the volume")
+                if c in free:
+                    clusters.append(c)
+                c += step
+        elif kind == "random":
+            window = self.free[:max(count * 8, 64)]
+            clusters = random.Random(int(arg or 1)).sample(window, count)
+        else:
+            raise ValueError("unknown layout " + layout)
+        self.take(clusters)
+        return clusters
+
+    def fat_bytes(self):
+        if self.fat == 12:
+            out = bytearray((len(self.table) * 3 + 1) // 2)
+            for n, v in enumerate(self.table):
+                o = n * 3 // 2
+                if n & 1:
+                    out[o] |= (v << 4) & 0xF0
+                    out[o + 1] = v >> 4
+                else:
+                    out[o] = v & 0xFF
+                    out[o + 1] = (v >> 8) & 0x0F
+        elif self.fat == 16:
+            out = bytearray(struct.pack("<%dH" % len(self.table), *self.table))
+        else:
+            out = bytearray(struct.pack("<%dI" % len(self.table), *self.table))
+        return bytes(out).ljust(self.fat_sectors * SECTOR, b"\0")
+
+    def boot_sector(self):
+        b = bytearray(SECTOR)
+        b[0:3] = b"\xEB\x58\x90" if self.fat == 32 else b"\xEB\x3C\x90"
+        b[3:11] = b"MKFATIMG"
+        total16 = self.sectors if self.sectors < 0x10000 else 0
+        fat16 = self.fat_sectors if self.fat != 32 else 0
+        struct.pack_into("<HBHBHHBHHHII", b, 11, SECTOR, self.spc, self.reserved, self.fats,
+                         self.root_entries, total16, 0xF8, fat16, 63, 255, self.start,
+                         0 if total16 else self.sectors)
+        if self.fat == 32:
+            struct.pack_into("<IHHIHH", b, 36, self.fat_sectors, 0, 0, 2, 1, 6)
+            ext = 64
+        else:
+            ext = 36
+        struct.pack_into("<BBBI", b, ext, 0x80, 0, 0x29, 0x2024F00D)
+        b[ext + 7:ext + 18] = b"TESTVOLUME "
+        b[ext + 18:ext + 26] = ("FAT%d   " % self.fat).encode("ascii")
+        b[510:512] = b"\x55\xAA"
+        return bytes(b)
+
+    def fsinfo(self):
+        b = bytearray(SECTOR)
+        struct.pack_into("<I", b, 0, 0x41615252)
+        struct.pack_into("<III", b, 484, 0x61417272, len(self.free),
+                         self.free[0] - 1 if self.free else 0xFFFFFFFF)
+        b[510:512] = b"\x55\xAA"
+        return bytes(b)
+
+
+def dir_entry(name, attr, clust, size):
+    return struct.pack("<11sBBBHHHHHHHI", name, attr, 0, 0, FAT_TIME, FAT_DATE, FAT_DATE,
+                       clust >> 16, FAT_TIME, FAT_DATE, clust & 0xFFFF, size)
+
+
+def build(args):
+    vol = Volume(args.fat, args.size, args.cluster, args.root_entries, args.reserved,
+                 args.fats, args.mbr_start if args.mbr else 0)
+    root = Node("", True)
+    files = []
+
+    def add(path, is_dir, size=0, layout="contiguous"):
+        parts = path.strip("/").split("/")
+        node = root
+        for i, part in enumerate(parts):
+            short_name(part)
+            last = i == len(parts) - 1
+            found = node.child(part.upper())
+            if found is None:
+                found = Node(part.upper(), is_dir or not last, size if last else 0,
+                             layout if last else "contiguous")
+                found.path = "/".join(p.upper() for p in parts[:i + 1])
+                node.children.append(found)
+            elif last:
+                raise ValueError("duplicate path " + path)
+            node = found
+        return node
+
+    for spec in args.dir or []:
+        path, _, count = spec.rpartition(":")
+        d = add(path, True)
+        for n in range(int(count)):
+            d.children.append(Node("F%07d.TXT" % n, False))
+            d.children[-1].path = d.path + "/F%07d.TXT" % n
+    for spec in args.file or []:
+        fields = spec.split(":")
+        layout = ":".join(fields[2:]) or args.layout
+        files.append(add(fields[0], False, size_arg(fields[1]), layout))
+    for seed, f in enumerate(files, 1):
+        f.seed = seed
+
+    # directories first, so they sit at the front of the data area
+    def dirs(node):
+        yield node
+        for c in node.children:
+            if c.is_dir:
+                yield from dirs(c)
+    cluster_bytes = vol.spc * SECTOR
+    for d in dirs(root):
+        entries = len(d.children) + (2 if d is not root else 0)
+        if d is root and vol.fat != 32:
+            if entries > vol.root_entries:
+                raise ValueError("%d entries do not fit the root directory" % entries)
+            continue
+        d.clusters = vol.allocate(max(1, -(-entries * 32 // cluster_bytes)), "contiguous")
+        vol.chain(d.clusters)
+
+    # then the files, interleaved ones together
+    needed = {id(f): -(-f.size // cluster_bytes) for f in files}
+    woven = [f for f in files if f.layout == "interleave" and needed[id(f)]]
+    while any(len(f.clusters) < needed[id(f)] for f in woven):
+        for f in woven:
+            if len(f.clusters) < needed[id(f)]:
+                f.clusters += vol.allocate(1, "contiguous")
+    for f in files:
+        if f.layout != "interleave" and needed[id(f)]:
+            f.clusters = vol.allocate(needed[id(f)], f.layout)
+        vol.chain(f.clusters)
+
+    return vol, root, files, dirs
+
+
+def write(args, vol, root, files, dirs):
+    base = vol.start * SECTOR
+    cluster_bytes = vol.spc * SECTOR
+
+    def put(sector, data):
+        img.seek(base + sector * SECTOR)
+        img.write(data)
+
+    def put_chain(clusters, data):
+        for n, c in enumerate(clusters):
+            put(vol.cluster_sector(c), data[n * cluster_bytes:(n + 1) * cluster_bytes])
+
+    with open(args.image, "wb") as img:
+        img.truncate(args.size)
+        if args.mbr:
+            mbr = bytearray(SECTOR)
+            struct.pack_into("<B3sB3sII", mbr, 446, 0x00, b"\xFE\xFF\xFF", PARTITION_TYPE[vol.fat],
+                             b"\xFE\xFF\xFF", vol.start, vol.sectors)
+            mbr[510:512] = b"\x55\xAA"
+            img.seek(0)
+            img.write(mbr)
+        put(0, vol.boot_sector())
+        if vol.fat == 32:
+            put(1, vol.fsinfo())
+            put(6, vol.boot_sector())
+        fat = vol.fat_bytes()
+        for n in range(vol.fats):
+            put(vol.fat_base + n * vol.fat_sectors, fat)
+
+        for d in dirs(root):
+            data = bytearray()
+            if d is not root:
+                parent = next(p for p in dirs(root) if d in p.children)
+                up = parent.clusters[0] if parent is not root and parent.clusters else 0
+                data += dir_entry(b".          ", 0x10, d.clusters[0], 0)
+                data += dir_entry(b"..         ", 0x10, up, 0)
+            for c in d.children:
+                data += dir_entry(short_name(c.name), 0x10 if c.is_dir else 0x20,
+                                  c.clusters[0] if c.clusters else 0, 0 if c.is_dir else c.size)
+            if d is root and vol.fat != 32:
+                put(vol.root_base, bytes(data))
+            else:
+                put_chain(d.clusters, bytes(data).ljust(len(d.clusters) * cluster_bytes, b"\0"))
+
+        for f in files:
+            put_chain(f.clusters, pattern(f.size, f.seed))
+
+
+def manifest(args, vol, root, files, dirs):
+    def fragments(clusters):
+        return sum(1 for a, b in zip(clusters, clusters[1:]) if b != a + 1) + (1 if clusters else 0)
+
+    out = {
+        "image": args.image,
+        "size": args.size,
+        "fat": vol.fat,
+        "mbr": bool(args.mbr),
+        "partition_start": vol.start,
+        "sector_size": SECTOR,
+        "sectors": vol.sectors,
+        "sectors_per_cluster": vol.spc,
+        "reserved_sectors": vol.reserved,
+        "fats": vol.fats,
+        "fat_sectors": vol.fat_sectors,
+        "root_entries": vol.root_entries,
+        "data_start": vol.data_base,
+        "clusters": vol.clusters,
+        "free_clusters": len(vol.free),
+        "pattern": "byte[i] = (i ^ (i >> 8) ^ seed) & 0xFF",
+        "directories": [],
+        "files": [],
+    }
+    for d in dirs(root):
+        if d is root:
+            continue
+        out["directories"].append({"path": d.path, "entries": len(d.children),
+                                   "clusters": d.clusters})
+    for f in files:
+        data = pattern(f.size, f.seed)
+        out["files"].append({
+            "path": f.path,
+            "size": f.size,
+            "layout": f.layout,
+            "seed": f.seed,
+            "first_cluster": f.clusters[0] if f.clusters else 0,
+            "clusters": f.clusters,
+            "fragments": fragments(f.clusters),
+            "crc32": "%08x" % zlib.crc32(data),
+        })
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter,
+                                     epilog=__doc__.split("\n", 2)[2])
+    parser.add_argument("image", help="image file to write")
+    parser.add_argument("--fat", type=int, choices=(12, 16, 32), default=32)
+    parser.add_argument("--size", type=size_arg, default=size_arg("64M"), help="image size (K, M, G)")
+    parser.add_argument("--cluster", type=size_arg, default=4096, help="cluster size in bytes")
+    parser.add_argument("--root-entries", type=int, default=512, help="FAT12/16 root directory entries")
+    parser.add_argument("--reserved", type=int, default=0, help="reserved sectors (default: 1, 32 on FAT32)")
+    parser.add_argument("--fats", type=int, default=2, choices=(1, 2))
+    parser.add_argument("--mbr", action="store_true", help="partition the image with an MBR")
+    parser.add_argument("--mbr-start", type=int, default=2048, help="partition start sector")
+    parser.add_argument("--file", action="append", metavar="PATH:SIZE[:LAYOUT]")
+    parser.add_argument("--dir", action="append", metavar="PATH:N")
+    parser.add_argument("--layout", default="contiguous", help="default file layout")
+    parser.add_argument("--manifest", help="write the manifest here (default: stdout)")
+    args = parser.parse_args()
+
+    try:
+        vol, root, files, dirs = build(args)
+    except ValueError as e:
+        print("mkfatimg: %s" % e, file=sys.stderr)
+        return 1
+    write(args, vol, root, files, dirs)
+    text = json.dumps(manifest(args, vol, root, files, dirs), indent=2)
+    if args.manifest:
+        with open(args.manifest, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
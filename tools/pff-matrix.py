@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+"""Benchmark Petit FatFs configurations against FAT12, FAT16 and FAT32
+volumes and tabulate code size against cycles and card transfers.
+
+For each FAT type the simbench workload in src/sdcard-fatfs-c is built
+with that type alone and with all three enabled, since supporting more than
+FAT32 is what turns off _FS_32ONLY and brings the type checks back into
+get_fat(), get_clust() and dir_rewind(). Each of those is combined with
+PF_USE_LSEEK, PF_USE_DIR and PF_USE_WRITE on and off (PF_USE_GROW follows
+PF_USE_WRITE). The pffconf.h settings are passed through the Makefiles'
+PFCONF.
+
+Every configuration is measured twice:
+
+  * simbench.ihx is built with SDCC for the ROM bytes of pff.c and of the
+    image, and run in ucsim for the cycles of each phase. ucsim has no card,
+    so this runs against the volume diskio_sim.c makes up (SIM_FAT), two
+    contiguous files in the root directory.
+
+  * host/bench, the same workload built natively, runs against images made
+    by mkfatimg.py, on files with contiguous, stride, interleaved and
+    reverse cluster chains and one two directories down. FAT12 entries
+    straddle FAT sectors there. Every read is checked against the image's
+    contents, and the write phase writes each file over and reads it back.
+    Phases report card transfers (disk_readp() calls and written sectors)
+    instead of cycles. The images are made afresh for every configuration.
+
+Phases that need a disabled option are empty.
+
+    tools/pff-matrix.py [--cc /opt/sdcc-4.1.6/bin/sdcc] [--sim s51] [--fat 32]
+"""
+
+import argparse
+import itertools
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+import sdccout
+import ucsim
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+PROJECT = os.path.join(ROOT, "src", "sdcard-fatfs-c")
+HOST = os.path.join(PROJECT, "host")
+MKFATIMG = os.path.join(ROOT, "tools", "mkfatimg.py")
+IMAGE = "simbench"
+
+# simbench reads 64 KiB files. SUB holds 40 empty files ahead of DEEP, so
+# finding SUB/DEEP/STREAM.BIN walks a directory over several sectors.
+FILES = [
+    "--dir", "SUB:40",
+    "--file", "STREAM.BIN:65536",
+    "--file", "STRIDE.BIN:65536:stride:3",
+    "--file", "WEAVE.BIN:65536:interleave",
+    "--file", "WEAVE2.BIN:65536:interleave",
+    "--file", "BACK.BIN:65536:reverse",
+    "--file", "SUB/DEEP/STREAM.BIN:65536",
+]
+
+# (label, path) of the files benchmarked on each image
+LAYOUTS = [
+    ("contiguous", "STREAM.BIN"),
+    ("stride:3", "STRIDE.BIN"),
+    ("interleave", "WEAVE.BIN"),
+    ("reverse", "BACK.BIN"),
+    ("subdirectory", "SUB/DEEP/STREAM.BIN"),
+]
+
+# mkfatimg.py geometry per FAT type, as the host tests' read images
+GEOMETRY = {
+    12: ["--size", "4M", "--cluster", "1024"],
+    16: ["--size", "16M", "--cluster", "2048", "--mbr"],
+    32: ["--size", "64M", "--cluster", "512", "--mbr"],
+}
+
+
+def run(args):
+    result = subprocess.run(args, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, universal_newlines=True)
+    return result.returncode == 0, result.stdout
+
+
+def make(cc, pfconf, sim_fat, *targets):
+    args = ["make", "-C", PROJECT, "PFCONF=" + pfconf, "SIM_FAT=%d" % sim_fat]
+    if cc:
+        args.append("CC=" + cc)
+    return run(args + list(targets))
+
+
+def make_image(directory, fat):
+    """Make the benchmark image for a FAT type, returning its path and the
+    seed of each file, or None if mkfatimg.py failed."""
+    image = os.path.join(directory, "fat%d.img" % fat)
+    manifest = os.path.join(directory, "fat%d.json" % fat)
+    ok, log = run([sys.executable, MKFATIMG, image, "--fat", str(fat)] + GEOMETRY[fat]
+                  + FILES + ["--manifest", manifest])
+    if not ok:
+        print(log, file=sys.stderr)
+        return None, {}
+    with open(manifest) as f:
+        seeds = {entry["path"]: entry["seed"] for entry in json.load(f)["files"]}
+    return image, seeds
+
+
+def configurations(fat_types):
+    for fat in fat_types:
+        for types in ((fat,), (12, 16, 32)):
+            for lseek, dir_, write in itertools.product((1, 0), repeat=3):
+                yield fat, types, {
+                    "PF_FS_FAT12": int(12 in types),
+                    "PF_FS_FAT16": int(16 in types),
+                    "PF_FS_FAT32": int(32 in types),
+                    "PF_USE_LSEEK": lseek,
+                    "PF_USE_DIR": dir_,
+                    "PF_USE_WRITE": write,
+                }
+
+
+def status(phases):
+    if phases.get("errors"):
+        return "read errors"
+    if "mount" not in phases:
+        return "no mount"
+    return "ok"
+
+
+def table(columns, rows):
+    print("| " + " | ".join(columns) + " |")
+    print("|" + "---|" * len(columns))
+    for row in rows:
+        print("| " + " | ".join(str(row.get(c, "")) for c in columns) + " |")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--cc", help="sdcc to build with (default: the Makefile's CC)")
+    parser.add_argument("--sim", default="s51", help="ucsim 8051 simulator")
+    parser.add_argument("--timeout", type=float, default=600,
+                        help="seconds to let each simulation run")
+    parser.add_argument("--fat", type=int, action="append", choices=(12, 16, 32),
+                        help="volume types to run (default: all)")
+    parser.add_argument("--no-sim", action="store_true",
+                        help="skip the SDCC builds and ucsim, only run the host benchmark")
+    args = parser.parse_args()
+
+    sim_rows = []
+    sim_phases = []
+    host_rows = []
+    host_phases = []
+    with tempfile.TemporaryDirectory() as tmp:
+        for fat, types, options in configurations(args.fat or (12, 16, 32)):
+            pfconf = " ".join("-D%s=%d" % item for item in options.items())
+            config = {
+                "volume": "FAT%d" % fat,
+                "types": "+".join(str(t) for t in types),
+                "lseek": options["PF_USE_LSEEK"],
+                "dir": options["PF_USE_DIR"],
+                "write": options["PF_USE_WRITE"],
+            }
+            print("building %s" % pfconf, file=sys.stderr)
+
+            if not args.no_sim:
+                row = dict(config)
+                sim_rows.append(row)
+                make(args.cc, pfconf, fat, "clean")
+                ok, log = make(args.cc, pfconf, fat, IMAGE + ".ihx")
+                if not ok:
+                    row["status"] = "build failed"
+                    print(log, file=sys.stderr)
+                else:
+                    row["pff code"] = sdccout.rom_bytes(sdccout.read_rst(os.path.join(PROJECT, "pff.rst")))
+                    row["image code"] = sdccout.read_mem(os.path.join(PROJECT, IMAGE + ".mem")).get("code", ("",))[0]
+                    phases = ucsim.run(args.sim, os.path.join(PROJECT, IMAGE + ".ihx"), args.timeout)
+                    row["status"] = status(phases)
+                    for name, cycles in phases.items():
+                        if name not in sim_phases:
+                            sim_phases.append(name)
+                        row[name] = cycles
+
+            ok, log = run(["make", "-C", HOST, "-B", "bench", "PFCONF=" + pfconf])
+            image, seeds = make_image(tmp, fat) if ok else (None, {})
+            for label, path in LAYOUTS:
+                row = dict(config, layout=label)
+                host_rows.append(row)
+                if not ok:
+                    row["status"] = "build failed"
+                    continue
+                if not image:
+                    row["status"] = "no image"
+                    continue
+                done, out = run([os.path.join(HOST, "bench"), image, path, str(seeds[path])])
+                phases = ucsim.parse(out)
+                row["status"] = status(phases) if done else "crashed"
+                for name, count in phases.items():
+                    if name not in host_phases:
+                        host_phases.append(name)
+                    row[name] = count
+            if not ok:
+                print(log, file=sys.stderr)
+    if not args.no_sim:
+        make(args.cc, "", 32, "clean")
+    run(["make", "-C", HOST, "clean"])
+
+    columns = ["volume", "types", "lseek", "dir", "write"]
+    if sim_rows:
+        print("Cycles in ucsim, diskio_sim.c volume\n")
+        table(columns + ["status", "pff code", "image code"] + sim_phases, sim_rows)
+        print()
+    print("Card transfers on the host, mkfatimg.py images\n")
+    table(columns + ["layout", "status"] + host_phases, host_rows)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,129 @@
+"""Readers for the files SDCC and its linker leave next to a build.
+
+    .mem  memory use summary of a linked image
+    .map  linker map, area placement
+    .rst  assembler listing relocated to final addresses, one per module
+"""
+
+import re
+
+_MEM_SIZE = r"\s+(?:0x[0-9A-Fa-f]+\s+0x[0-9A-Fa-f]+\s+)?(\d+)\s+(\d+)"
+
+
+def read_mem(path):
+    """Memory use from a .mem file as a dict. code, xram and pdata hold
+    (used, max) pairs, iram is everything below the stack and stack is the
+    number of bytes left for it. Missing entries are left out."""
+    sizes = {}
+    try:
+        with open(path) as f:
+            text = f.read()
+    except OSError:
+        return sizes
+    for name, label in (("code", r"ROM/EPROM/FLASH"), ("xram", r"EXTERNAL RAM"),
+                        ("pdata", r"PAGED EXT\. RAM")):
+        m = re.search(label + _MEM_SIZE, text)
+        if m:
+            sizes[name] = (int(m.group(1)), int(m.group(2)))
+    m = re.search(r"Stack starts at: (0x[0-9A-Fa-f]+).*?with (\d+) bytes available", text)
+    if m:
+        sizes["iram"] = int(m.group(1), 0)
+        sizes["stack"] = int(m.group(2))
+    return sizes
+
+
+def read_map(path):
+    """Areas and linked modules from a .map file. Areas are
+    {name: (address, size, attributes)}, modules the names of the .rel files
+    linked from the project, not the libraries."""
+    areas = {}
+    modules = []
+    area = re.compile(r"^(\w+)\s+([0-9A-Fa-f]+)\s+([0-9A-Fa-f]+)\s+=\s+(\d+)\.\s+bytes\s+\(([^)]*)\)")
+    rel = re.compile(r"^(\S+)\.rel\s+\[")
+    section = None
+    try:
+        with open(path) as f:
+            for line in f:
+                if line.startswith("Files Linked"):
+                    section = "files"
+                elif line.startswith("Libraries Linked"):
+                    section = None
+                m = area.match(line)
+                if m:
+                    areas[m.group(1)] = (int(m.group(2), 16), int(m.group(4)), m.group(5))
+                m = rel.match(line)
+                if m and section == "files":
+                    modules.append(m.group(1).split("/")[-1])
+    except OSError:
+        pass
+    return areas, modules
+
+
+# areas that end up in ROM
+CODE_AREAS = ("HOME", "GSINIT", "GSFINAL", "CSEG", "CONST", "XINIT", "INITIALIZER", "CABS")
+
+
+# a listing line that holds code: address, bytes, optional [cycles] field,
+# source line number and the source text
+_RST_CODE = re.compile(r"^\s+([0-9A-Fa-f]{4,8})((?:\s[0-9A-Fa-f]{2})+)\s+(?:\[\s*(\d+)\])?\s*(\d+)\s(.*)$")
+_RST_LABEL = re.compile(r"^\s+([0-9A-Fa-f]{4,8})\s+(\d+)\s+([\w$]+):")
+_RST_FUNCTION = re.compile(r";\s+function\s+(\w+)")
+_RST_AREA = re.compile(r"\.area\s+(\w+)")
+
+
+def read_rst(path):
+    """Lines of a .rst listing as dicts with area, function, label (a label
+    defined on the line or None), address, bytes (list of ints), cycles (the
+    assembler's count in oscillator periods, or None) and text. Lines that
+    emit nothing have address None."""
+    lines = []
+    area = None
+    function = None
+    with open(path, errors="replace") as f:
+        for raw in f:
+            raw = raw.rstrip("\n")
+            entry = {"area": area, "function": function, "label": None,
+                     "address": None, "bytes": [], "cycles": None, "text": raw}
+            m = _RST_FUNCTION.search(raw)
+            if m:
+                function = m.group(1)
+                entry["function"] = function
+            m = _RST_AREA.search(raw)
+            if m and ";" not in raw.split(".area")[0]:
+                area = m.group(1)
+                entry["area"] = area
+            m = _RST_LABEL.match(raw)
+            if m:
+                entry["address"] = int(m.group(1), 16)
+                entry["label"] = m.group(3)
+            else:
+                m = _RST_CODE.match(raw)
+                if m:
+                    entry["address"] = int(m.group(1), 16)
+                    entry["bytes"] = [int(b, 16) for b in m.group(2).split()]
+                    entry["cycles"] = int(m.group(3)) if m.group(3) else None
+                    entry["text"] = m.group(5)
+            lines.append(entry)
+    return lines
+
+
+def functions(lines):
+    """Code bytes of every function in a listing, {name: bytes}. A function
+    starts at its label, _name, under the '; function name' comment SDCC
+    writes before it, and runs until the next one. Sizes are counted from
+    the listed bytes, so they don't depend on where the module was linked."""
+    sizes = {}
+    current = None
+    for entry in lines:
+        name = entry["function"]
+        if name and entry["label"] == "_" + name and name not in sizes:
+            current = name
+            sizes[name] = 0
+        if current and entry["area"] == "CSEG":
+            sizes[current] += len(entry["bytes"])
+    return sizes
+
+
+def rom_bytes(lines):
+    """Bytes a listing puts in ROM."""
+    return sum(len(e["bytes"]) for e in lines if e["area"] in CODE_AREAS)
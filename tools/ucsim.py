@@ -0,0 +1,48 @@
+"""Run a benchmark image in the ucsim 8051 simulator.
+
+The image reports over the on-chip serial port with "<phase> <value>"
+lines and ends with a "done" line, as src/sdcard-fatfs-c/simbench.c does.
+"""
+
+import os
+import subprocess
+import tempfile
+import time
+
+
+def run(sim, image, timeout):
+    """Run an image in ucsim until it prints "done", returning the
+    "<phase> <cycles>" lines it sent to the serial port."""
+    with tempfile.TemporaryDirectory() as tmp:
+        serial = os.path.join(tmp, "serial.txt")
+        try:
+            proc = subprocess.Popen(
+                [sim, "-t", "8051", "-X", "11.0592M", "-S", "out=" + serial, image],
+                stdin=subprocess.PIPE, stdout=subprocess.DEVNULL,
+                stderr=subprocess.DEVNULL, universal_newlines=True)
+        except OSError:
+            return {}
+        proc.stdin.write("run\n")
+        proc.stdin.flush()
+        text = ""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            time.sleep(0.5)
+            if os.path.exists(serial):
+                with open(serial) as f:
+                    text = f.read()
+                if "done" in text:
+                    break
+        proc.kill()
+        proc.wait()
+    return parse(text)
+
+
+def parse(text):
+    """The "<phase> <value>" lines of a benchmark's output as a dict."""
+    phases = {}
+    for line in text.splitlines():
+        fields = line.split()
+        if len(fields) == 2 and fields[1].isdigit():
+            phases[fields[0]] = int(fields[1])
+    return phases